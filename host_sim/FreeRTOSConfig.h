@@ -0,0 +1,75 @@
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+// Kernel configuration for the host simulation on the FreeRTOS POSIX port.
+// Tick rate, priorities and allocation match the firmware's sdkconfig; stack
+// depths are in words here, so every firmware stack is 8x larger on the host.
+
+#define configUSE_PREEMPTION						1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION		0
+#define configUSE_TICKLESS_IDLE						0
+#define configTICK_RATE_HZ							100
+#define configMAX_PRIORITIES						25
+#define configMINIMAL_STACK_SIZE					2048
+#define configMAX_TASK_NAME_LEN						16
+#define configUSE_16_BIT_TICKS						0
+#define configIDLE_SHOULD_YIELD						1
+#define configUSE_TASK_NOTIFICATIONS				1
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES		1
+#define configUSE_MUTEXES							1
+#define configUSE_RECURSIVE_MUTEXES					1
+#define configUSE_COUNTING_SEMAPHORES				1
+#define configUSE_QUEUE_SETS						1
+#define configQUEUE_REGISTRY_SIZE					0
+#define configUSE_TIME_SLICING						1
+#define configUSE_NEWLIB_REENTRANT					0
+#define configENABLE_BACKWARD_COMPATIBILITY			1
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS		1
+#define configSTACK_DEPTH_TYPE						uint32_t
+#define configMESSAGE_BUFFER_LENGTH_TYPE			size_t
+
+#define configSUPPORT_STATIC_ALLOCATION				1
+#define configSUPPORT_DYNAMIC_ALLOCATION			1
+#define configTOTAL_HEAP_SIZE						(1024 * 1024)
+#define configAPPLICATION_ALLOCATED_HEAP			0
+
+#define configUSE_IDLE_HOOK							1
+#define configUSE_TICK_HOOK							0
+#define configCHECK_FOR_STACK_OVERFLOW				0
+#define configUSE_MALLOC_FAILED_HOOK				0
+#define configUSE_DAEMON_TASK_STARTUP_HOOK			0
+
+#define configGENERATE_RUN_TIME_STATS				0
+#define configUSE_TRACE_FACILITY					1
+#define configUSE_STATS_FORMATTING_FUNCTIONS		0
+
+#define configUSE_TIMERS							1
+#define configTIMER_TASK_PRIORITY					(configMAX_PRIORITIES - 1)
+#define configTIMER_QUEUE_LENGTH					16
+#define configTIMER_TASK_STACK_DEPTH				configMINIMAL_STACK_SIZE
+
+#define INCLUDE_vTaskPrioritySet					1
+#define INCLUDE_uxTaskPriorityGet					1
+#define INCLUDE_vTaskDelete							1
+#define INCLUDE_vTaskSuspend						1
+#define INCLUDE_xTaskDelayUntil						1
+#define INCLUDE_vTaskDelay							1
+#define INCLUDE_xTaskGetSchedulerState				1
+#define INCLUDE_xTaskGetCurrentTaskHandle			1
+#define INCLUDE_uxTaskGetStackHighWaterMark			1
+#define INCLUDE_xTaskGetIdleTaskHandle				1
+#define INCLUDE_eTaskGetState						1
+#define INCLUDE_xTimerPendFunctionCall				1
+#define INCLUDE_xTaskAbortDelay						1
+#define INCLUDE_xTaskGetHandle						1
+
+#include <assert.h>
+#define configASSERT(x)								assert(x)
+
+// ESP-IDF calls TLS delete callbacks once the idle task has freed a deleted
+// task; the simulation records deletions here and runs the callbacks from the
+// idle hook (sim_rtos.c).
+extern void sim_task_deleted(void *tcb);
+#define traceTASK_DELETE(pxTCB)						sim_task_deleted(pxTCB)
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,9 @@
+#ifndef SIM_DISKIO_SDMMC_H
+#define SIM_DISKIO_SDMMC_H
+
+#include <stdint.h>
+#include "sdmmc_cmd.h"
+
+uint8_t ff_diskio_get_pdrv_card(const sdmmc_card_t *card);
+
+#endif /* SIM_DISKIO_SDMMC_H */
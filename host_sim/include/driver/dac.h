@@ -0,0 +1,18 @@
+#ifndef SIM_DRIVER_DAC_H
+#define SIM_DRIVER_DAC_H
+
+#include "driver/gpio.h"
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+	DAC_CHANNEL_1 = 0,
+	DAC_CHANNEL_2,
+	DAC_CHANNEL_MAX,
+} dac_channel_t;
+
+esp_err_t dac_output_enable(dac_channel_t channel);
+esp_err_t dac_output_disable(dac_channel_t channel);
+esp_err_t dac_output_voltage(dac_channel_t channel, uint8_t value);
+
+#endif /* SIM_DRIVER_DAC_H */
@@ -0,0 +1,60 @@
+#ifndef SIM_DRIVER_I2S_H
+#define SIM_DRIVER_I2S_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+
+// The DAC is a virtual DMA chain drained in real time at the configured
+// sample rate; i2s_write blocks while the chain is full.
+typedef int i2s_port_t;
+
+#define I2S_NUM_0							0
+#define I2S_MODE_MASTER						(1 << 0)
+#define I2S_MODE_SLAVE						(1 << 1)
+#define I2S_MODE_TX							(1 << 2)
+#define I2S_MODE_RX							(1 << 3)
+#define I2S_BITS_PER_SAMPLE_16BIT			16
+#define I2S_CHANNEL_FMT_RIGHT_LEFT			0
+#define I2S_COMM_FORMAT_STAND_I2S			0x01
+#define I2S_COMM_FORMAT_STAND_MSB			0x03
+#define I2S_COMM_FORMAT_I2S					0x01
+#define I2S_COMM_FORMAT_I2S_MSB				0x02
+#define I2S_PIN_NO_CHANGE					-1
+#define ESP_INTR_FLAG_LEVEL1				(1 << 1)
+
+typedef struct {
+	int mode;
+	int sample_rate;
+	int bits_per_sample;
+	int channel_format;
+	int communication_format;
+	int intr_alloc_flags;
+	int dma_buf_count;
+	int dma_buf_len;
+	bool use_apll;
+	bool tx_desc_auto_clear;
+	int fixed_mclk;
+} i2s_config_t;
+
+typedef struct {
+	int bck_io_num;
+	int ws_io_num;
+	int data_out_num;
+	int data_in_num;
+} i2s_pin_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins);
+esp_err_t i2s_set_clk(i2s_port_t port, uint32_t rate, uint32_t bits, int ch);
+float i2s_get_clk(i2s_port_t port);
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port);
+esp_err_t i2s_start(i2s_port_t port);
+esp_err_t i2s_stop(i2s_port_t port);
+
+#endif /* SIM_DRIVER_I2S_H */
@@ -0,0 +1,12 @@
+#ifndef SIM_DRIVER_RMT_H
+#define SIM_DRIVER_RMT_H
+
+#include "driver/gpio.h"
+
+typedef enum {
+	RMT_CHANNEL_0 = 0,
+	RMT_CHANNEL_1,
+	RMT_CHANNEL_MAX,
+} rmt_channel_t;
+
+#endif /* SIM_DRIVER_RMT_H */
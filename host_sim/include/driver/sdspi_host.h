@@ -0,0 +1,9 @@
+#ifndef SIM_DRIVER_SDSPI_HOST_H
+#define SIM_DRIVER_SDSPI_HOST_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t sdspi_host_set_card_clk(int host, uint32_t freq_khz);
+
+#endif /* SIM_DRIVER_SDSPI_HOST_H */
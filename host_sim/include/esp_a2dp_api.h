@@ -0,0 +1,80 @@
+#ifndef SIM_ESP_A2DP_API_H
+#define SIM_ESP_A2DP_API_H
+
+#include "esp_bt_defs.h"
+
+#define ESP_A2D_MCT_SBC						(0)
+
+typedef uint8_t esp_a2d_mct_t;
+
+typedef struct {
+	esp_a2d_mct_t type;
+	union {
+		uint8_t sbc[4];
+		uint8_t m12[4];
+		uint8_t m24[6];
+		uint8_t atrac[7];
+	} cie;
+} __attribute__((packed)) esp_a2d_mcc_t;
+
+typedef enum {
+	ESP_A2D_CONNECTION_STATE_DISCONNECTED = 0,
+	ESP_A2D_CONNECTION_STATE_CONNECTING,
+	ESP_A2D_CONNECTION_STATE_CONNECTED,
+	ESP_A2D_CONNECTION_STATE_DISCONNECTING,
+} esp_a2d_connection_state_t;
+
+typedef enum {
+	ESP_A2D_DISC_RSN_NORMAL = 0,
+	ESP_A2D_DISC_RSN_ABNORMAL,
+} esp_a2d_disc_rsn_t;
+
+typedef enum {
+	ESP_A2D_AUDIO_STATE_REMOTE_SUSPEND = 0,
+	ESP_A2D_AUDIO_STATE_STOPPED,
+	ESP_A2D_AUDIO_STATE_STARTED,
+} esp_a2d_audio_state_t;
+
+typedef enum {
+	ESP_A2D_DEINIT_SUCCESS = 0,
+	ESP_A2D_INIT_SUCCESS,
+} esp_a2d_init_state_t;
+
+typedef enum {
+	ESP_A2D_CONNECTION_STATE_EVT = 0,
+	ESP_A2D_AUDIO_STATE_EVT,
+	ESP_A2D_AUDIO_CFG_EVT,
+	ESP_A2D_MEDIA_CTRL_ACK_EVT,
+	ESP_A2D_PROF_STATE_EVT,
+} esp_a2d_cb_event_t;
+
+typedef union {
+	struct a2d_conn_stat_param {
+		esp_a2d_connection_state_t state;
+		esp_bd_addr_t remote_bda;
+		esp_a2d_disc_rsn_t disc_rsn;
+	} conn_stat;
+	struct a2d_audio_stat_param {
+		esp_a2d_audio_state_t state;
+		esp_bd_addr_t remote_bda;
+	} audio_stat;
+	struct a2d_audio_cfg_param {
+		esp_bd_addr_t remote_bda;
+		esp_a2d_mcc_t mcc;
+	} audio_cfg;
+	struct a2d_prof_stat_param {
+		esp_a2d_init_state_t init_state;
+	} a2d_prof_stat;
+} esp_a2d_cb_param_t;
+
+typedef void (*esp_a2d_cb_t)(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param);
+typedef void (*esp_a2d_sink_data_cb_t)(const uint8_t *buf, uint32_t len);
+
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t callback);
+esp_err_t esp_a2d_sink_register_data_callback(esp_a2d_sink_data_cb_t callback);
+esp_err_t esp_a2d_sink_init(void);
+esp_err_t esp_a2d_sink_deinit(void);
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t remote_bda);
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t remote_bda);
+
+#endif /* SIM_ESP_A2DP_API_H */
@@ -0,0 +1,8 @@
+#ifndef SIM_ESP_ATTR_H
+#define SIM_ESP_ATTR_H
+
+#define WORD_ALIGNED_ATTR					__attribute__((aligned(4)))
+#define DRAM_ATTR
+#define DMA_ATTR							WORD_ALIGNED_ATTR DRAM_ATTR
+
+#endif /* SIM_ESP_ATTR_H */
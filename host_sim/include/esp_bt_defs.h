@@ -0,0 +1,16 @@
+#ifndef SIM_ESP_BT_DEFS_H
+#define SIM_ESP_BT_DEFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_BD_ADDR_LEN						6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+
+typedef enum {
+	ESP_BT_STATUS_SUCCESS = 0,
+	ESP_BT_STATUS_FAIL,
+} esp_bt_status_t;
+
+#endif /* SIM_ESP_BT_DEFS_H */
@@ -0,0 +1,20 @@
+#ifndef SIM_ESP_DSP_H
+#define SIM_ESP_DSP_H
+
+#include "esp_err.h"
+
+// Plain C versions of the esp-dsp routines the firmware calls. The radix-2 FFT
+// leaves its output in bit-reversed order, as the library does.
+esp_err_t dsps_fft2r_init_fc32(float *fft_table_buff, int table_size);
+void dsps_fft2r_deinit_fc32(void);
+esp_err_t dsps_fft2r_fc32_ansi_(float *data, int N, float *w);
+esp_err_t dsps_bit_rev_fc32_ansi(float *data, int N);
+esp_err_t dsps_biquad_f32_ansi(const float *input, float *output, int len, float *coef, float *w);
+esp_err_t dsps_biquad_gen_hpf_f32(float *coeffs, float f, float qFactor);
+esp_err_t dsps_biquad_gen_lowShelf_f32(float *coeffs, float f, float gain, float qFactor);
+
+#define dsps_fft2r_fc32_ae32_				dsps_fft2r_fc32_ansi_
+#define dsps_bit_rev_fc32					dsps_bit_rev_fc32_ansi
+#define dsps_biquad_f32_ae32				dsps_biquad_f32_ansi
+
+#endif /* SIM_ESP_DSP_H */
@@ -0,0 +1,64 @@
+#ifndef SIM_ESP_SPP_API_H
+#define SIM_ESP_SPP_API_H
+
+#include "esp_bt_defs.h"
+
+#define ESP_SPP_SEC_NONE					0x0000
+
+typedef enum {
+	ESP_SPP_ROLE_MASTER = 0,
+	ESP_SPP_ROLE_SLAVE = 1,
+} esp_spp_role_t;
+
+typedef enum {
+	ESP_SPP_MODE_CB = 0,
+	ESP_SPP_MODE_VFS = 1,
+} esp_spp_mode_t;
+
+typedef enum {
+	ESP_SPP_INIT_EVT = 0,
+	ESP_SPP_UNINIT_EVT = 1,
+	ESP_SPP_DISCOVERY_COMP_EVT = 8,
+	ESP_SPP_OPEN_EVT = 26,
+	ESP_SPP_CLOSE_EVT = 27,
+	ESP_SPP_START_EVT = 28,
+	ESP_SPP_CL_INIT_EVT = 29,
+	ESP_SPP_DATA_IND_EVT = 30,
+	ESP_SPP_CONG_EVT = 31,
+	ESP_SPP_WRITE_EVT = 33,
+	ESP_SPP_SRV_OPEN_EVT = 34,
+} esp_spp_cb_event_t;
+
+typedef union {
+	struct {
+		uint32_t handle;
+		esp_bd_addr_t rem_bda;
+	} srv_open;
+	struct {
+		uint32_t handle;
+	} close;
+	struct {
+		uint32_t handle;
+		uint16_t len;
+		uint8_t *data;
+	} data_ind;
+	struct {
+		uint32_t handle;
+		int len;
+		bool cong;
+	} write;
+	struct {
+		uint32_t handle;
+		bool cong;
+	} cong;
+} esp_spp_cb_param_t;
+
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback);
+esp_err_t esp_spp_init(esp_spp_mode_t mode);
+esp_err_t esp_spp_start_srv(uint16_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char *name);
+esp_err_t esp_spp_write(uint32_t handle, int len, uint8_t *p_data);
+esp_err_t esp_spp_disconnect(uint32_t handle);
+
+#endif /* SIM_ESP_SPP_API_H */
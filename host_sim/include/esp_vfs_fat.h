@@ -0,0 +1,40 @@
+#ifndef SIM_ESP_VFS_FAT_H
+#define SIM_ESP_VFS_FAT_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+// The card is a host directory: paths under the mount point are redirected
+// there (sim_drivers.c wraps fopen and stat at link time).
+#define SPI2_HOST							1
+#define SPI3_HOST							2
+
+typedef struct {
+	int mosi_io_num;
+	int miso_io_num;
+	int sclk_io_num;
+	int quadwp_io_num;
+	int quadhd_io_num;
+	int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct {
+	int host_id;
+	int gpio_cs;
+} sdspi_device_config_t;
+
+typedef struct {
+	bool format_if_mount_failed;
+	int max_files;
+	size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+#define SDSPI_HOST_DEFAULT()				{ .slot = SPI2_HOST, .max_freq_khz = SDMMC_FREQ_DEFAULT }
+#define SDSPI_DEVICE_CONFIG_DEFAULT()		{ .host_id = SPI2_HOST, .gpio_cs = 13 }
+
+esp_err_t spi_bus_initialize(int host, const spi_bus_config_t *bus, int dma_chan);
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path, const sdmmc_host_t *host,
+		const sdspi_device_config_t *slot, const esp_vfs_fat_sdmmc_mount_config_t *mount, sdmmc_card_t **card);
+
+#endif /* SIM_ESP_VFS_FAT_H */
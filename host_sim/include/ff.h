@@ -0,0 +1,51 @@
+#ifndef SIM_FF_H
+#define SIM_FF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The parts of FatFs the firmware reaches past stdio for. Each open file gets
+// its own run of sectors, as if it had been copied onto a freshly formatted
+// card: one cluster after the other (sim_drivers.c).
+#define FF_MIN_SS							512
+#define FF_MAX_SS							512
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t FSIZE_t;
+typedef uint32_t LBA_t;
+
+typedef enum {
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_NO_FILE = 4,
+} FRESULT;
+
+#define FA_READ								0x01
+
+typedef struct {
+	WORD csize;
+	LBA_t database;
+} FATFS;
+
+typedef struct {
+	FATFS *fs;
+	DWORD sclust;
+	FSIZE_t objsize;
+} FFOBJID;
+
+typedef struct {
+	FFOBJID obj;
+	FSIZE_t fptr;
+	DWORD clust;
+	FATFS fs;
+} FIL;
+
+#define f_size(fp)							((fp)->obj.objsize)
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_close(FIL *fp);
+
+#endif /* SIM_FF_H */
@@ -0,0 +1,33 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+// ESP-IDF flavour of FreeRTOS on top of the upstream kernel's POSIX port.
+// The host runs one core: critical sections ignore their spinlock and
+// pinned task creation ignores the core.
+#include <FreeRTOS.h>
+#include "sdkconfig.h"
+
+typedef struct {
+	uint32_t owner;
+	uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED		{ 0, 0 }
+#define portNUM_PROCESSORS					1
+#define tskNO_AFFINITY						0x7FFFFFFF
+
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+#define portENTER_CRITICAL(mux)				((void)(mux), vPortEnterCritical())
+#define portEXIT_CRITICAL(mux)				((void)(mux), vPortExitCritical())
+#define portENTER_CRITICAL_ISR(mux)			((void)(mux), vPortEnterCritical())
+#define portEXIT_CRITICAL_ISR(mux)			((void)(mux), vPortExitCritical())
+#define portENTER_CRITICAL_SAFE(mux)		((void)(mux), vPortEnterCritical())
+#define portEXIT_CRITICAL_SAFE(mux)			((void)(mux), vPortExitCritical())
+#define xPortGetCoreID()					0
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define WORD_ALIGNED_ATTR					__attribute__((aligned(4)))
+
+#endif /* SIM_FREERTOS_H */
@@ -0,0 +1,7 @@
+#ifndef SIM_EVENT_GROUPS_H
+#define SIM_EVENT_GROUPS_H
+
+#include "freertos/FreeRTOS.h"
+#include <event_groups.h>
+
+#endif /* SIM_EVENT_GROUPS_H */
@@ -0,0 +1,7 @@
+#ifndef SIM_QUEUE_H
+#define SIM_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+#include <queue.h>
+
+#endif /* SIM_QUEUE_H */
@@ -0,0 +1,41 @@
+#ifndef SIM_RINGBUF_H
+#define SIM_RINGBUF_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Byte-buffer subset of the ESP-IDF ring buffer (sim_rtos.c). Items are
+// contiguous runs of bytes; a received item must be returned before the next
+// receive.
+typedef void * RingbufHandle_t;
+
+typedef enum {
+	RINGBUF_TYPE_NOSPLIT = 0,
+	RINGBUF_TYPE_ALLOWSPLIT,
+	RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+typedef struct {
+	uint8_t *storage;
+	size_t size;
+	size_t read;
+	size_t used;
+	size_t held;
+	bool dynamic;
+	SemaphoreHandle_t data_sem;
+	SemaphoreHandle_t space_sem;
+	StaticSemaphore_t data_sem_buf;
+	StaticSemaphore_t space_sem_buf;
+} StaticRingbuffer_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage, StaticRingbuffer_t *buf);
+void vRingbufferDelete(RingbufHandle_t ring);
+UBaseType_t xRingbufferSend(RingbufHandle_t ring, const void *data, size_t size, TickType_t ticks);
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *size, TickType_t ticks);
+void *xRingbufferReceiveUpTo(RingbufHandle_t ring, size_t *size, TickType_t ticks, size_t max_size);
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ring);
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t ring);
+
+#endif /* SIM_RINGBUF_H */
@@ -0,0 +1,7 @@
+#ifndef SIM_STREAM_BUFFER_H
+#define SIM_STREAM_BUFFER_H
+
+#include "freertos/FreeRTOS.h"
+#include <stream_buffer.h>
+
+#endif /* SIM_STREAM_BUFFER_H */
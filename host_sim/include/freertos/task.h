@@ -0,0 +1,17 @@
+#ifndef SIM_TASK_H
+#define SIM_TASK_H
+
+#include "freertos/FreeRTOS.h"
+#include <task.h>
+
+#define xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle, core) \
+	xTaskCreate(fn, name, stack, arg, prio, handle)
+#define xTaskCreateStaticPinnedToCore(fn, name, stack, arg, prio, stack_buf, tcb, core) \
+	xTaskCreateStatic(fn, name, stack, arg, prio, stack_buf, tcb)
+
+typedef void (*TlsDeleteCallbackFunction_t)(int, void *);
+
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t task, BaseType_t index, void *value,
+		TlsDeleteCallbackFunction_t cb);
+
+#endif /* SIM_TASK_H */
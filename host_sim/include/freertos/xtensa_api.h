@@ -0,0 +1,6 @@
+#ifndef SIM_XTENSA_API_H
+#define SIM_XTENSA_API_H
+
+// Nothing from the Xtensa HAL is used on the host.
+
+#endif /* SIM_XTENSA_API_H */
@@ -0,0 +1,19 @@
+#ifndef SIM_LED_STRIP_H
+#define SIM_LED_STRIP_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct led_strip_s led_strip_t;
+
+struct led_strip_s {
+	esp_err_t (*set_pixel)(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue);
+	esp_err_t (*refresh)(led_strip_t *strip, uint32_t timeout_ms);
+	esp_err_t (*clear)(led_strip_t *strip, uint32_t timeout_ms);
+	esp_err_t (*del)(led_strip_t *strip);
+};
+
+led_strip_t *led_strip_init(uint8_t channel, uint8_t gpio, uint16_t led_num);
+esp_err_t led_strip_denit(led_strip_t *strip);
+
+#endif /* SIM_LED_STRIP_H */
@@ -0,0 +1,8 @@
+#ifndef SIM_NVS_FLASH_H
+#define SIM_NVS_FLASH_H
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init(void);
+
+#endif /* SIM_NVS_FLASH_H */
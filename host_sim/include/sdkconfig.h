@@ -0,0 +1,52 @@
+#ifndef __SDKCONFIG_H__
+#define __SDKCONFIG_H__
+
+// Host simulation configuration: the SpecBox Kconfig defaults plus the few
+// IDF options the firmware reads. Keep in step with main/Kconfig.projbuild.
+// The benches are off as in Kconfig; configure with -DSIM_BENCH=ON to run the
+// beat, SD and log benches.
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS 1
+
+#define CONFIG_SPECBOX_LIGHT_TRACK 1
+#define CONFIG_SPECBOX_LIGHT_SYNC 1
+#define CONFIG_SPECBOX_LIGHT_SYNC_OFFSET_MS 0
+#define CONFIG_SPECBOX_NEON_ENVELOPE 1
+#define CONFIG_SPECBOX_ENV_ATTACK_MS 5
+#define CONFIG_SPECBOX_ENV_RELEASE_MS 200
+#define CONFIG_SPECBOX_DRIFT_MAX_PPM 300
+#define CONFIG_SPECBOX_DEFAULT_LATENCY_PROFILE 1
+#define CONFIG_SPECBOX_LATENCY_AUTO 1
+#define CONFIG_SPECBOX_TASK_PLACEMENT_PINNED 1
+#define CONFIG_SPECBOX_CONTROL_CORE 0
+#define CONFIG_SPECBOX_AUDIO_CORE 1
+#define CONFIG_SPECBOX_PRIO_DISPATCH 22
+#define CONFIG_SPECBOX_PRIO_I2S 20
+#define CONFIG_SPECBOX_PRIO_DEFAULT 10
+#define CONFIG_SPECBOX_PRIO_COLOR 5
+#define CONFIG_SPECBOX_PRIO_CMD 4
+#define CONFIG_SPECBOX_PRIO_SENSOR 2
+#define CONFIG_SPECBOX_INGRESS_TIMEOUT_MS 0
+#define CONFIG_SPECBOX_OVERFLOW_DROP_OLDEST 1
+#define CONFIG_SPECBOX_GOVERNOR 1
+#define CONFIG_SPECBOX_GOV_ECO_SOC 50
+#define CONFIG_SPECBOX_GOV_SAVER_SOC 20
+#define CONFIG_SPECBOX_PERSIST_PERIOD_S 300
+#define CONFIG_SPECBOX_SYNC_PLAYOUT_MS 50
+#define CONFIG_SPECBOX_SYNC_PING_MS 1000
+#define CONFIG_SPECBOX_BEAT_PULSE 30
+#define CONFIG_SPECBOX_DSP_CHAIN 1
+#define CONFIG_SPECBOX_DSP_HPF_HZ 80
+#define CONFIG_SPECBOX_DSP_BASS_DB 4
+#define CONFIG_SPECBOX_DSP_LIMITER_DB -1
+#define CONFIG_SPECBOX_DSP_LOOKAHEAD_MS 2
+#define CONFIG_SPECBOX_DSP_BUDGET_PCT 10
+#define CONFIG_SPECBOX_SD_STREAM_KB 16
+#define CONFIG_SPECBOX_SD_FREQ_KHZ 20000
+#define CONFIG_SPECBOX_LOG_DEFER 1
+#define CONFIG_SPECBOX_LOG_SLOTS 64
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 240
+#define CONFIG_SPECBOX_SOAK_CYCLES 0
+
+#endif /* __SDKCONFIG_H__ */
@@ -0,0 +1,27 @@
+#ifndef SIM_SDMMC_CMD_H
+#define SIM_SDMMC_CMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SDMMC_FREQ_DEFAULT					20000
+#define SDMMC_FREQ_HIGHSPEED				40000
+
+typedef struct {
+	int slot;
+	int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+	sdmmc_host_t host;
+	int max_freq_khz;
+	struct {
+		uint32_t capacity;
+		uint32_t sector_size;
+	} csd;
+} sdmmc_card_t;
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector, size_t sector_count);
+
+#endif /* SIM_SDMMC_CMD_H */
@@ -0,0 +1,12 @@
+#ifndef SIM_SYS_LOCK_H
+#define SIM_SYS_LOCK_H
+
+#include <stdint.h>
+
+// newlib locks, backed by a FreeRTOS mutex created on first use
+typedef intptr_t _lock_t;
+
+void _lock_acquire(_lock_t *lock);
+void _lock_release(_lock_t *lock);
+
+#endif /* SIM_SYS_LOCK_H */
@@ -0,0 +1,10 @@
+#ifndef SIM_XTENSA_HAL_H
+#define SIM_XTENSA_HAL_H
+
+#include <stdint.h>
+
+// Cycles of a CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ core, counted off the host's
+// monotonic clock
+uint32_t xthal_get_ccount(void);
+
+#endif /* SIM_XTENSA_HAL_H */
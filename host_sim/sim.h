@@ -0,0 +1,47 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Host simulation of the SpecBox firmware: the unmodified main/ sources run on
+// the FreeRTOS POSIX port against the driver and Bluetooth stand-ins below.
+
+typedef struct {
+	const char *sd_dir;				// host directory mounted as /sdcard
+	const char *a2dp_wav;			// what the simulated phone streams, under sd_dir
+	uint32_t seconds;				// time spent in each mode
+	int32_t drift_ppm;				// phone clock against the DAC clock
+	uint32_t max_miss_permille;		// light deadline misses tolerated
+} sim_options_t;
+
+typedef struct {
+	uint64_t i2s_bytes;
+	uint32_t i2s_writes;
+	uint32_t i2s_underruns;
+	uint32_t dac_writes;
+	uint8_t dac[2];
+	uint32_t led_refreshes;
+	uint32_t a2dp_blocks;
+	uint32_t a2dp_stalls;
+	uint32_t spp_tx_bytes;
+	uint32_t servo_fades;
+	uint32_t nvs_commits;
+	uint32_t sd_reads;
+	uint32_t sd_sectors;
+} sim_stats_t;
+
+extern sim_options_t sim_opt;
+extern sim_stats_t sim_stats;
+
+// sim_drivers.c
+extern const char *sim_sd_path(const char *path, char *buf, size_t len);
+
+// sim_bt.c: the remote side of the SPP link
+extern bool sim_spp_listening(void);
+extern void sim_spp_open(void);
+extern void sim_spp_send(const uint8_t *data, uint16_t len);
+extern void sim_spp_close(void);
+
+#endif /* __SIM_H__ */
@@ -0,0 +1,427 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_bt_device.h"
+#include "esp_gap_bt_api.h"
+#include "esp_a2dp_api.h"
+#include "esp_avrc_api.h"
+#include "esp_spp_api.h"
+#include "sim.h"
+
+#define TAG "SIM_BT"
+
+// Bluedroid stand-in. Callbacks are delivered from one "BTC" task in the order
+// the stack would send them, each after a short delay. The A2DP peer streams
+// a WAV from the SD directory at its sample rate, optionally off by
+// sim_opt.drift_ppm; the SPP peer is driven by the scenario in sim_main.c.
+#define BTC_PRIO					(configMAX_PRIORITIES - 6)
+#define BTC_STACK					4096
+#define BTC_QUEUE_LEN				16
+#define SPP_DATA_MAX				128
+#define SPP_HANDLE					0x81
+#define A2D_INIT_MS					20
+#define A2D_CONNECT_MS				150
+#define A2D_BLOCK					4096
+#define A2D_RATE					44100
+#define A2D_STALL_US				100000
+#define WAV_HEADER					44
+
+#define EVT_A2D						0
+#define EVT_SPP						1
+#define EVT_A2D_SOURCE				2
+
+typedef struct {
+	uint8_t kind;
+	uint16_t event;
+	uint16_t delay_ms;
+	union {
+		esp_a2d_cb_param_t a2d;
+		esp_spp_cb_param_t spp;
+	} param;
+	uint8_t data[SPP_DATA_MAX];
+} btc_evt_t;
+
+static const esp_bd_addr_t peer_bda = { 0x5e, 0x1a, 0x00, 0x5b, 0x0c, 0x01 };
+
+static QueueHandle_t btc_queue;
+static esp_a2d_cb_t a2d_cb;
+static esp_a2d_sink_data_cb_t a2d_data_cb;
+static esp_spp_cb_t spp_cb;
+static bool sink_ready, a2d_connected, spp_listening;
+static volatile bool streaming;
+static TaskHandle_t source_handle;
+static SemaphoreHandle_t source_done;
+
+static void btc_post(btc_evt_t *evt)
+{
+	xQueueSend(btc_queue, evt, portMAX_DELAY);
+}
+
+static void post_a2d(uint16_t event, uint16_t delay_ms, const esp_a2d_cb_param_t *param)
+{
+	btc_evt_t evt = { .kind = EVT_A2D, .event = event, .delay_ms = delay_ms };
+	evt.param.a2d = *param;
+	btc_post(&evt);
+}
+
+static void post_a2d_conn(esp_a2d_connection_state_t state, uint16_t delay_ms)
+{
+	esp_a2d_cb_param_t p = { .conn_stat = { .state = state } };
+	memcpy(p.conn_stat.remote_bda, peer_bda, ESP_BD_ADDR_LEN);
+	post_a2d(ESP_A2D_CONNECTION_STATE_EVT, delay_ms, &p);
+}
+
+static void post_spp(uint16_t event, const esp_spp_cb_param_t *param, const uint8_t *data, uint16_t len)
+{
+	btc_evt_t evt = { .kind = EVT_SPP, .event = event };
+	if(param != NULL) evt.param.spp = *param;
+	if(len > 0){
+		memcpy(evt.data, data, len);
+		evt.param.spp.data_ind.len = len;
+	}
+	btc_post(&evt);
+}
+
+//--------------------- A2DP source -------------------------------
+static void source_task(void *arg)
+{
+	static uint8_t block[A2D_BLOCK];
+	char path[512];
+	FILE *f;
+	int64_t start = esp_timer_get_time(), due, now;
+	double period_us = A2D_BLOCK / 4 * 1e6 / A2D_RATE / (1.0 + sim_opt.drift_ppm * 1e-6);
+	uint32_t k = 0;
+	size_t n;
+
+	snprintf(path, sizeof(path), "%s/%s", sim_opt.sd_dir, sim_opt.a2dp_wav);
+	f = fopen(path, "rb");
+	if(f == NULL) ESP_LOGW(TAG, "Can't open %s, streaming silence", path);
+	else fseek(f, WAV_HEADER, SEEK_SET);
+
+	while(streaming){
+		due = start + (int64_t)(k * period_us);
+		now = esp_timer_get_time();
+		if(now < due) vTaskDelay((due - now) / (portTICK_PERIOD_MS * 1000) + 1);
+		else if(now - due > A2D_STALL_US) sim_stats.a2dp_stalls += 1;
+		if(!streaming) break;
+
+		memset(block, 0, sizeof(block));
+		if(f != NULL && (n = fread(block, 1, sizeof(block), f)) < sizeof(block)){
+			fseek(f, WAV_HEADER, SEEK_SET);
+			fread(block + n, 1, sizeof(block) - n, f);
+		}
+		if(a2d_data_cb != NULL) a2d_data_cb(block, sizeof(block));
+		sim_stats.a2dp_blocks += 1;
+		k += 1;
+	}
+	if(f != NULL) fclose(f);
+	xSemaphoreGive(source_done);
+	vTaskDelete(NULL);
+}
+
+static void source_stop(void)
+{
+	if(!streaming) return;
+	streaming = false;
+	xSemaphoreTake(source_done, portMAX_DELAY);
+	source_handle = NULL;
+}
+
+//--------------------- BTC task ----------------------------------
+static void btc_task(void *arg)
+{
+	btc_evt_t evt;
+
+	while(true){
+		xQueueReceive(btc_queue, &evt, portMAX_DELAY);
+		if(evt.delay_ms) vTaskDelay(pdMS_TO_TICKS(evt.delay_ms));
+		switch(evt.kind){
+		case EVT_A2D:
+			if(a2d_cb != NULL) a2d_cb(evt.event, &evt.param.a2d);
+			break;
+		case EVT_SPP:
+			if(evt.event == ESP_SPP_DATA_IND_EVT){
+				evt.param.spp.data_ind.handle = SPP_HANDLE;
+				evt.param.spp.data_ind.data = evt.data;
+			}
+			if(spp_cb != NULL) spp_cb(evt.event, &evt.param.spp);
+			break;
+		case EVT_A2D_SOURCE:
+			if(a2d_connected && !streaming){
+				streaming = true;
+				xTaskCreate(source_task, "sim_a2d_src", BTC_STACK, NULL, BTC_PRIO, &source_handle);
+			}
+			break;
+		}
+	}
+}
+
+//--------------------- Stack bring-up ----------------------------
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void)
+{
+	if(btc_queue != NULL) return ESP_ERR_INVALID_STATE;
+	btc_queue = xQueueCreate(BTC_QUEUE_LEN, sizeof(btc_evt_t));
+	source_done = xSemaphoreCreateBinary();
+	return xTaskCreate(btc_task, "sim_btc", BTC_STACK, NULL, BTC_PRIO, NULL) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_bluedroid_enable(void)
+{
+	return btc_queue != NULL ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_bt_dev_set_device_name(const char *name)
+{
+	ESP_LOGI(TAG, "Device name %s", name);
+	return ESP_OK;
+}
+
+const uint8_t *esp_bt_dev_get_address(void)
+{
+	static const uint8_t addr[ESP_BD_ADDR_LEN] = { 0x24, 0x0a, 0xc4, 0x5b, 0x0c, 0x01 };
+
+	return addr;
+}
+
+//--------------------- GAP and AVRCP -----------------------------
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t callback)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_pin_reply(esp_bd_addr_t bd_addr, bool accept, uint8_t pin_code_len, esp_bt_pin_code_t pin_code)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_ssp_confirm_reply(esp_bd_addr_t bd_addr, bool accept)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_init(void)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_register_callback(esp_avrc_ct_cb_t callback)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_metadata_cmd(uint8_t tl, uint8_t attr_mask)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_register_notification_cmd(uint8_t tl, uint8_t event_id, uint32_t event_parameter)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_get_rn_capabilities_cmd(uint8_t tl)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_tg_init(void)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_tg_register_callback(esp_avrc_tg_cb_t callback)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_tg_set_rn_evt_cap(const esp_avrc_rn_evt_cap_mask_t *evt_set)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_avrc_tg_send_rn_rsp(esp_avrc_rn_event_ids_t event_id, esp_avrc_rn_rsp_t rsp, esp_avrc_rn_param_t *param)
+{
+	return ESP_OK;
+}
+
+bool esp_avrc_rn_evt_bit_mask_operation(esp_avrc_bit_mask_op_t op, esp_avrc_rn_evt_cap_mask_t *events,
+		esp_avrc_rn_event_ids_t event_id)
+{
+	if(events == NULL || event_id >= ESP_AVRC_RN_MAX_EVT) return false;
+	switch(op){
+	case ESP_AVRC_BIT_MASK_OP_TEST:
+		return (events->bits & (1 << event_id)) != 0;
+	case ESP_AVRC_BIT_MASK_OP_SET:
+		events->bits |= 1 << event_id;
+		break;
+	case ESP_AVRC_BIT_MASK_OP_CLEAR:
+		events->bits &= ~(1 << event_id);
+		break;
+	}
+	return true;
+}
+
+//--------------------- A2DP sink ---------------------------------
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t callback)
+{
+	a2d_cb = callback;
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_register_data_callback(esp_a2d_sink_data_cb_t callback)
+{
+	a2d_data_cb = callback;
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_init(void)
+{
+	esp_a2d_cb_param_t p = { .a2d_prof_stat = { ESP_A2D_INIT_SUCCESS } };
+
+	if(btc_queue == NULL || sink_ready) return ESP_ERR_INVALID_STATE;
+	sink_ready = true;
+	post_a2d(ESP_A2D_PROF_STATE_EVT, A2D_INIT_MS, &p);
+	return ESP_OK;
+}
+
+// Like Bluedroid, a deinit without init fails and sends nothing
+esp_err_t esp_a2d_sink_deinit(void)
+{
+	esp_a2d_cb_param_t p = { .a2d_prof_stat = { ESP_A2D_DEINIT_SUCCESS } };
+
+	if(!sink_ready) return ESP_ERR_INVALID_STATE;
+	sink_ready = false;
+	source_stop();
+	if(a2d_connected){
+		a2d_connected = false;
+		post_a2d_conn(ESP_A2D_CONNECTION_STATE_DISCONNECTED, 0);
+	}
+	post_a2d(ESP_A2D_PROF_STATE_EVT, A2D_INIT_MS, &p);
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t remote_bda)
+{
+	esp_a2d_cb_param_t p = { 0 };
+	btc_evt_t start = { .kind = EVT_A2D_SOURCE };
+
+	if(!sink_ready || a2d_connected) return ESP_ERR_INVALID_STATE;
+	a2d_connected = true;
+	post_a2d_conn(ESP_A2D_CONNECTION_STATE_CONNECTING, 0);
+	post_a2d_conn(ESP_A2D_CONNECTION_STATE_CONNECTED, A2D_CONNECT_MS);
+
+	memcpy(p.audio_cfg.remote_bda, peer_bda, ESP_BD_ADDR_LEN);
+	p.audio_cfg.mcc.type = ESP_A2D_MCT_SBC;
+	p.audio_cfg.mcc.cie.sbc[0] = 0x21;			// 44.1 kHz, joint stereo
+	p.audio_cfg.mcc.cie.sbc[1] = 0x15;
+	p.audio_cfg.mcc.cie.sbc[2] = 2;
+	p.audio_cfg.mcc.cie.sbc[3] = 53;
+	post_a2d(ESP_A2D_AUDIO_CFG_EVT, 0, &p);
+
+	memset(&p, 0, sizeof(p));
+	p.audio_stat.state = ESP_A2D_AUDIO_STATE_STARTED;
+	memcpy(p.audio_stat.remote_bda, peer_bda, ESP_BD_ADDR_LEN);
+	post_a2d(ESP_A2D_AUDIO_STATE_EVT, 0, &p);
+	btc_post(&start);
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t remote_bda)
+{
+	esp_a2d_cb_param_t p = { .audio_stat = { .state = ESP_A2D_AUDIO_STATE_STOPPED } };
+
+	if(!a2d_connected) return ESP_ERR_INVALID_STATE;
+	a2d_connected = false;
+	source_stop();
+	post_a2d(ESP_A2D_AUDIO_STATE_EVT, 0, &p);
+	post_a2d_conn(ESP_A2D_CONNECTION_STATE_DISCONNECTING, 0);
+	post_a2d_conn(ESP_A2D_CONNECTION_STATE_DISCONNECTED, A2D_INIT_MS);
+	return ESP_OK;
+}
+
+//--------------------- SPP ---------------------------------------
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback)
+{
+	spp_cb = callback;
+	return ESP_OK;
+}
+
+esp_err_t esp_spp_init(esp_spp_mode_t mode)
+{
+	if(btc_queue == NULL) return ESP_ERR_INVALID_STATE;
+	post_spp(ESP_SPP_INIT_EVT, NULL, NULL, 0);
+	return ESP_OK;
+}
+
+esp_err_t esp_spp_start_srv(uint16_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char *name)
+{
+	spp_listening = true;
+	post_spp(ESP_SPP_START_EVT, NULL, NULL, 0);
+	return ESP_OK;
+}
+
+esp_err_t esp_spp_write(uint32_t handle, int len, uint8_t *p_data)
+{
+	sim_stats.spp_tx_bytes += len;
+	return ESP_OK;
+}
+
+esp_err_t esp_spp_disconnect(uint32_t handle)
+{
+	sim_spp_close();
+	return ESP_OK;
+}
+
+bool sim_spp_listening(void)
+{
+	return spp_listening;
+}
+
+void sim_spp_open(void)
+{
+	esp_spp_cb_param_t p = { .srv_open = { .handle = SPP_HANDLE } };
+	memcpy(p.srv_open.rem_bda, peer_bda, ESP_BD_ADDR_LEN);
+	post_spp(ESP_SPP_SRV_OPEN_EVT, &p, NULL, 0);
+}
+
+void sim_spp_send(const uint8_t *data, uint16_t len)
+{
+	if(len > SPP_DATA_MAX) len = SPP_DATA_MAX;
+	post_spp(ESP_SPP_DATA_IND_EVT, NULL, data, len);
+}
+
+void sim_spp_close(void)
+{
+	esp_spp_cb_param_t p = { .close = { .handle = SPP_HANDLE } };
+	post_spp(ESP_SPP_CLOSE_EVT, &p, NULL, 0);
+}
@@ -0,0 +1,760 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_vfs_fat.h"
+#include "driver/sdspi_host.h"
+#include "diskio_sdmmc.h"
+#include "ff.h"
+#include "driver/i2s.h"
+#include "driver/dac.h"
+#include "driver/adc.h"
+#include "driver/ledc.h"
+#include "led_strip.h"
+#include "esp_dsp.h"
+#include "xtensa/hal.h"
+#include "sim.h"
+
+// Stand-ins for the ESP-IDF drivers the firmware uses. Audio and LED output
+// is counted rather than produced; the SD card is a host directory.
+
+sim_stats_t sim_stats;
+
+//--------------------- Time and logging --------------------------
+static int64_t t_origin;
+
+__attribute__((constructor)) static void sim_clock_init(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t_origin = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - t_origin;
+}
+
+uint32_t xthal_get_ccount(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((ts.tv_sec * 1000000000LL + ts.tv_nsec) * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
+
+esp_log_level_t sim_log_level = ESP_LOG_INFO;
+static vprintf_like_t log_vprintf = vprintf;
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+	vprintf_like_t old = log_vprintf;
+	log_vprintf = func;
+	return old;
+}
+
+// Per-tag levels are not kept; "*" sets the level for all tags
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+	if(strcmp(tag, "*") == 0) sim_log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	log_vprintf(format, ap);
+	va_end(ap);
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t len)
+{
+	const uint8_t *p = buffer;
+	char line[16 * 3 + 1];
+	int i, n;
+
+	while(len > 0){
+		n = len < 16 ? len : 16;
+		for(i = 0; i < n; i++) sprintf(line + i * 3, "%02x ", p[i]);
+		ESP_LOGI(tag, "%s", line);
+		p += n;
+		len -= n;
+	}
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+	switch(code){
+	case ESP_OK: return "ESP_OK";
+	case ESP_FAIL: return "ESP_FAIL";
+	case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+	case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+	case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+	case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+	case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+	case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+	case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+	case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+	default: return "UNKNOWN ERROR";
+	}
+}
+
+//--------------------- Heap and NVS ------------------------------
+static size_t heap_min_free = SIZE_MAX;
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	return caps & MALLOC_CAP_SPIRAM ? NULL : malloc(size);
+}
+
+void heap_caps_free(void *ptr)
+{
+	free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	size_t n = caps & MALLOC_CAP_SPIRAM ? 0 : mallinfo2().fordblks;
+	if(n < heap_min_free && !(caps & MALLOC_CAP_SPIRAM)) heap_min_free = n;
+	return n;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	return caps & MALLOC_CAP_SPIRAM ? 0 : mallinfo2().fordblks;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+	if(caps & MALLOC_CAP_SPIRAM) return 0;
+	heap_caps_get_free_size(caps);
+	return heap_min_free;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+	return ESP_OK;
+}
+
+// NVS lives in memory for the run: blobs by namespace and key, and a handle is
+// the namespace index plus one
+#define SIM_NVS_BLOBS				8
+#define SIM_NVS_NAME				16
+
+typedef struct {
+	char ns[SIM_NVS_NAME];
+	char key[SIM_NVS_NAME];
+	void *data;
+	size_t len;
+} sim_nvs_blob_t;
+
+static sim_nvs_blob_t nvs_blobs[SIM_NVS_BLOBS];
+static char nvs_spaces[SIM_NVS_BLOBS][SIM_NVS_NAME];
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+	int i;
+
+	for(i = 0; i < SIM_NVS_BLOBS; i++){
+		if(strcmp(nvs_spaces[i], name) == 0) break;
+	}
+	if(i == SIM_NVS_BLOBS){
+		if(open_mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+		for(i = 0; i < SIM_NVS_BLOBS && nvs_spaces[i][0]; i++);
+		if(i == SIM_NVS_BLOBS) return ESP_ERR_NO_MEM;
+		strncpy(nvs_spaces[i], name, SIM_NVS_NAME - 1);
+	}
+	*out_handle = i + 1;
+	return ESP_OK;
+}
+
+static sim_nvs_blob_t *nvs_find(nvs_handle_t handle, const char *key)
+{
+	int i;
+
+	for(i = 0; i < SIM_NVS_BLOBS; i++){
+		if(nvs_blobs[i].data && strcmp(nvs_blobs[i].ns, nvs_spaces[handle - 1]) == 0 &&
+				strcmp(nvs_blobs[i].key, key) == 0) return &nvs_blobs[i];
+	}
+	return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+	sim_nvs_blob_t *b = nvs_find(handle, key);
+
+	if(b == NULL) return ESP_ERR_NVS_NOT_FOUND;
+	if(out_value == NULL){
+		*length = b->len;
+		return ESP_OK;
+	}
+	if(*length < b->len) return ESP_ERR_INVALID_SIZE;
+	memcpy(out_value, b->data, b->len);
+	*length = b->len;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+	sim_nvs_blob_t *b = nvs_find(handle, key);
+	int i;
+
+	if(b == NULL){
+		for(i = 0; i < SIM_NVS_BLOBS && nvs_blobs[i].data; i++);
+		if(i == SIM_NVS_BLOBS) return ESP_ERR_NO_MEM;
+		b = &nvs_blobs[i];
+		strncpy(b->ns, nvs_spaces[handle - 1], SIM_NVS_NAME - 1);
+		strncpy(b->key, key, SIM_NVS_NAME - 1);
+	}
+	free(b->data);
+	b->data = malloc(length);
+	memcpy(b->data, value, length);
+	b->len = length;
+	return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	sim_stats.nvs_commits += 1;
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+//--------------------- SD card -----------------------------------
+// Paths under the mount point go to sim_opt.sd_dir. The firmware's calls to
+// fopen and stat are wrapped at link time (-Wl,--wrap=fopen,--wrap=stat).
+static const char *sd_mount;
+static sdmmc_card_t sd_card;
+
+FILE *__real_fopen(const char *path, const char *mode);
+int __real_stat(const char *path, struct stat *st);
+
+const char *sim_sd_path(const char *path, char *buf, size_t len)
+{
+	size_t m = sd_mount != NULL ? strlen(sd_mount) : 0;
+
+	if(m == 0 || strncmp(path, sd_mount, m) != 0 || (path[m] != '/' && path[m] != 0)) return path;
+	snprintf(buf, len, "%s%s", sim_opt.sd_dir, path + m);
+	return buf;
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode)
+{
+	char buf[512];
+	return __real_fopen(sim_sd_path(path, buf, sizeof(buf)), mode);
+}
+
+int __wrap_stat(const char *path, struct stat *st)
+{
+	char buf[512];
+	return __real_stat(sim_sd_path(path, buf, sizeof(buf)), st);
+}
+
+esp_err_t spi_bus_initialize(int host, const spi_bus_config_t *bus, int dma_chan)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path, const sdmmc_host_t *host,
+		const sdspi_device_config_t *slot, const esp_vfs_fat_sdmmc_mount_config_t *mount, sdmmc_card_t **card)
+{
+	struct stat st;
+	struct statvfs vfs;
+
+	if(sim_opt.sd_dir == NULL || __real_stat(sim_opt.sd_dir, &st) != 0 || !S_ISDIR(st.st_mode)) return ESP_FAIL;
+	sd_card.host = *host;
+	sd_card.max_freq_khz = host->max_freq_khz;
+	sd_card.csd.sector_size = 512;
+	sd_card.csd.capacity = statvfs(sim_opt.sd_dir, &vfs) == 0 ?
+			(uint32_t)fmin((double)vfs.f_blocks * vfs.f_frsize / 512, UINT32_MAX) : 0;
+	sd_mount = base_path;
+	if(card != NULL) *card = &sd_card;
+	return ESP_OK;
+}
+
+// FatFs opens give each file SD_FILE_SECTORS of its own, clusters in order;
+// raw sector reads find the file by the range.
+#define SD_FILES					8
+#define SD_FILE_SECTORS				(1u << 22)
+#define SD_CLUSTER_SECTORS			32
+
+static char sd_files[SD_FILES][512];
+
+uint8_t ff_diskio_get_pdrv_card(const sdmmc_card_t *card)
+{
+	return 0;
+}
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode)
+{
+	const char *rel = strchr(path, ':');
+	struct stat st;
+	char buf[512];
+	int i;
+
+	if(rel == NULL || sim_opt.sd_dir == NULL) return FR_NO_FILE;
+	snprintf(buf, sizeof(buf), "%s%s", sim_opt.sd_dir, rel + 1);
+	if(__real_stat(buf, &st) != 0 || !S_ISREG(st.st_mode)) return FR_NO_FILE;
+	for(i = 0; i < SD_FILES && sd_files[i][0] != 0 && strcmp(sd_files[i], buf) != 0; i++);
+	if(i == SD_FILES) return FR_DISK_ERR;
+	snprintf(sd_files[i], sizeof(sd_files[i]), "%s", buf);
+	memset(fp, 0, sizeof(*fp));
+	fp->fs.csize = SD_CLUSTER_SECTORS;
+	fp->fs.database = (i + 1) * SD_FILE_SECTORS;
+	fp->obj.fs = &fp->fs;
+	fp->obj.sclust = 2;
+	fp->obj.objsize = st.st_size;
+	fp->clust = 2;
+	return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	fp->fptr = ofs < fp->obj.objsize ? ofs : fp->obj.objsize;
+	fp->clust = fp->obj.sclust + (fp->fptr > 0 ? (fp->fptr - 1) / (SD_CLUSTER_SECTORS * 512) : 0);
+	return FR_OK;
+}
+
+FRESULT f_close(FIL *fp)
+{
+	return FR_OK;
+}
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector, size_t sector_count)
+{
+	size_t i = start_sector / SD_FILE_SECTORS - 1, n;
+	FILE *f;
+
+	if(i >= SD_FILES || sd_files[i][0] == 0 || (f = __real_fopen(sd_files[i], "rb")) == NULL) return ESP_FAIL;
+	fseek(f, (start_sector % SD_FILE_SECTORS) * 512, SEEK_SET);
+	n = fread(dst, 1, sector_count * 512, f);
+	// the rest of the last cluster reads as whatever was there
+	memset((uint8_t *)dst + n, 0, sector_count * 512 - n);
+	fclose(f);
+	sim_stats.sd_reads += 1;
+	sim_stats.sd_sectors += sector_count;
+	return ESP_OK;
+}
+
+esp_err_t sdspi_host_set_card_clk(int host, uint32_t freq_khz)
+{
+	return ESP_OK;
+}
+
+//--------------------- I2S ---------------------------------------
+// The DMA chain holds dma_buf_count * dma_buf_len frames and drains at the
+// sample rate. Writes block in ticks while it is full; the chain running dry
+// between writes of a stream counts as an underrun.
+#define I2S_PAUSE_US				1000000
+
+static struct {
+	bool installed;
+	uint32_t rate;
+	size_t capacity;
+	double level;
+	int64_t last_us;
+	int64_t dry_us;
+} i2s;
+
+static void i2s_drain(void)
+{
+	int64_t now = esp_timer_get_time();
+	double out = (now - i2s.last_us) * (i2s.rate * 4.0 / 1e6);
+
+	if(i2s.level > 0 && out >= i2s.level) i2s.dry_us = i2s.last_us + (int64_t)(i2s.level * 1e6 / (i2s.rate * 4.0));
+	i2s.level = out >= i2s.level ? 0 : i2s.level - out;
+	i2s.last_us = now;
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue)
+{
+	if(i2s.installed) return ESP_ERR_INVALID_STATE;
+	i2s.installed = true;
+	i2s.rate = config->sample_rate;
+	i2s.capacity = config->dma_buf_count * config->dma_buf_len * 4;
+	i2s.level = 0;
+	i2s.last_us = esp_timer_get_time();
+	i2s.dry_us = 0;
+	return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port)
+{
+	if(!i2s.installed) return ESP_ERR_INVALID_STATE;
+	i2s.installed = false;
+	return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins)
+{
+	return ESP_OK;
+}
+
+esp_err_t i2s_set_clk(i2s_port_t port, uint32_t rate, uint32_t bits, int ch)
+{
+	if(!i2s.installed) return ESP_ERR_INVALID_STATE;
+	i2s_drain();
+	i2s.rate = rate;
+	return ESP_OK;
+}
+
+float i2s_get_clk(i2s_port_t port)
+{
+	return i2s.installed ? i2s.rate : 0;
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks)
+{
+	TickType_t start = xTaskGetTickCount();
+	size_t done = 0, n;
+
+	if(!i2s.installed) return ESP_ERR_INVALID_STATE;
+	i2s_drain();
+	if(i2s.level == 0 && i2s.dry_us != 0 && i2s.last_us - i2s.dry_us < I2S_PAUSE_US) sim_stats.i2s_underruns += 1;
+	i2s.dry_us = 0;
+	while(true){
+		n = i2s.capacity - (size_t)i2s.level;
+		if(n > size - done) n = size - done;
+		i2s.level += n;
+		done += n;
+		if(done == size || (ticks != portMAX_DELAY && xTaskGetTickCount() - start >= ticks)) break;
+		vTaskDelay(1);
+		i2s_drain();
+	}
+	sim_stats.i2s_bytes += done;
+	sim_stats.i2s_writes += 1;
+	if(written != NULL) *written = done;
+	return done == size ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port)
+{
+	if(!i2s.installed) return ESP_ERR_INVALID_STATE;
+	i2s_drain();
+	i2s.level = 0;
+	i2s.dry_us = 0;
+	return ESP_OK;
+}
+
+esp_err_t i2s_start(i2s_port_t port)
+{
+	return ESP_OK;
+}
+
+esp_err_t i2s_stop(i2s_port_t port)
+{
+	return ESP_OK;
+}
+
+//--------------------- DAC and ADC -------------------------------
+// The battery reads a little above LOW_CHARGE_BOUND with some noise; the
+// charger is not connected.
+#define SIM_BATTERY_RAW				650
+
+esp_err_t dac_output_enable(dac_channel_t channel)
+{
+	return ESP_OK;
+}
+
+esp_err_t dac_output_disable(dac_channel_t channel)
+{
+	return ESP_OK;
+}
+
+esp_err_t dac_output_voltage(dac_channel_t channel, uint8_t value)
+{
+	if(channel >= DAC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	sim_stats.dac[channel] = value;
+	sim_stats.dac_writes += 1;
+	return ESP_OK;
+}
+
+esp_err_t adc1_config_width(adc_bits_width_t width)
+{
+	return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+	return ESP_OK;
+}
+
+esp_err_t adc2_config_channel_atten(adc2_channel_t channel, adc_atten_t atten)
+{
+	return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel)
+{
+	return 0;
+}
+
+esp_err_t adc2_get_raw(adc2_channel_t channel, adc_bits_width_t width, int *raw)
+{
+	*raw = SIM_BATTERY_RAW + rand() % 5 - 2;
+	return ESP_OK;
+}
+
+//--------------------- LEDC --------------------------------------
+static struct {
+	uint32_t duty;
+	uint32_t target;
+	int fade_ms;
+} ledc[LEDC_CHANNEL_MAX];
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config)
+{
+	return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config)
+{
+	if(config->channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	ledc[config->channel].duty = ledc[config->channel].target = config->duty;
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+	return ESP_OK;
+}
+
+void ledc_fade_func_uninstall(void)
+{
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+	if(channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	ledc[channel].target = target_duty;
+	ledc[channel].fade_ms = max_fade_time_ms;
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+	if(channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	if(fade_mode == LEDC_FADE_WAIT_DONE) vTaskDelay(pdMS_TO_TICKS(ledc[channel].fade_ms));
+	ledc[channel].duty = ledc[channel].target;
+	sim_stats.servo_fades += 1;
+	return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty)
+{
+	if(channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	ledc[channel].target = duty;
+	return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel)
+{
+	if(channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+	ledc[channel].duty = ledc[channel].target;
+	return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t mode, ledc_channel_t channel)
+{
+	return channel < LEDC_CHANNEL_MAX ? ledc[channel].duty : 0;
+}
+
+esp_err_t ledc_stop(ledc_mode_t mode, ledc_channel_t channel, uint32_t idle_level)
+{
+	return ESP_OK;
+}
+
+//--------------------- LED strip ---------------------------------
+typedef struct {
+	led_strip_t parent;
+	uint16_t n;
+	uint8_t pixels[][3];
+} sim_strip_t;
+
+static esp_err_t strip_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+	sim_strip_t *s = (sim_strip_t *)strip;
+
+	if(index >= s->n) return ESP_ERR_INVALID_ARG;
+	s->pixels[index][0] = red;
+	s->pixels[index][1] = green;
+	s->pixels[index][2] = blue;
+	return ESP_OK;
+}
+
+// the RMT driver blocks for the frame on the wire: 24 bits of 1.25 us per LED, then the reset
+static esp_err_t strip_refresh(led_strip_t *strip, uint32_t timeout_ms)
+{
+	sim_strip_t *s = (sim_strip_t *)strip;
+	struct timespec ts = { 0, (s->n * 30 + 50) * 1000 };
+
+	nanosleep(&ts, NULL);
+	sim_stats.led_refreshes += 1;
+	return ESP_OK;
+}
+
+static esp_err_t strip_clear(led_strip_t *strip, uint32_t timeout_ms)
+{
+	sim_strip_t *s = (sim_strip_t *)strip;
+
+	memset(s->pixels, 0, s->n * sizeof(s->pixels[0]));
+	return strip_refresh(strip, timeout_ms);
+}
+
+static esp_err_t strip_del(led_strip_t *strip)
+{
+	free(strip);
+	return ESP_OK;
+}
+
+led_strip_t *led_strip_init(uint8_t channel, uint8_t gpio, uint16_t led_num)
+{
+	sim_strip_t *s = calloc(1, sizeof(*s) + led_num * sizeof(s->pixels[0]));
+
+	if(s == NULL) return NULL;
+	s->n = led_num;
+	s->parent.set_pixel = strip_set_pixel;
+	s->parent.refresh = strip_refresh;
+	s->parent.clear = strip_clear;
+	s->parent.del = strip_del;
+	return &s->parent;
+}
+
+esp_err_t led_strip_denit(led_strip_t *strip)
+{
+	return strip->del(strip);
+}
+
+//--------------------- esp-dsp -----------------------------------
+// The library's ANSI code paths: twiddles as cos/sin over half the length in
+// bit-reversed order, and the in-place radix-2 butterflies.
+esp_err_t dsps_bit_rev_fc32_ansi(float *data, int N)
+{
+	int i, j = 0, k;
+	float t;
+
+	if(N <= 0 || (N & (N - 1)) != 0) return ESP_ERR_INVALID_ARG;
+	for(i = 1; i < N - 1; i++){
+		for(k = N >> 1; k <= j; k >>= 1) j -= k;
+		j += k;
+		if(i < j){
+			t = data[j * 2];
+			data[j * 2] = data[i * 2];
+			data[i * 2] = t;
+			t = data[j * 2 + 1];
+			data[j * 2 + 1] = data[i * 2 + 1];
+			data[i * 2 + 1] = t;
+		}
+	}
+	return ESP_OK;
+}
+
+esp_err_t dsps_fft2r_init_fc32(float *fft_table_buff, int table_size)
+{
+	float e = M_PI * 2.0f / table_size;
+	int i;
+
+	if(fft_table_buff == NULL) return ESP_ERR_NOT_SUPPORTED;
+	for(i = 0; i < (table_size >> 1); i++){
+		fft_table_buff[2 * i] = cosf(i * e);
+		fft_table_buff[2 * i + 1] = sinf(i * e);
+	}
+	return dsps_bit_rev_fc32_ansi(fft_table_buff, table_size >> 1);
+}
+
+void dsps_fft2r_deinit_fc32(void)
+{
+}
+
+// Direct form II, coef: b0 b1 b2 a1 a2
+esp_err_t dsps_biquad_f32_ansi(const float *input, float *output, int len, float *coef, float *w)
+{
+	float d0;
+	int i;
+
+	for(i = 0; i < len; i++){
+		d0 = input[i] - coef[3] * w[0] - coef[4] * w[1];
+		output[i] = coef[0] * d0 + coef[1] * w[0] + coef[2] * w[1];
+		w[1] = w[0];
+		w[0] = d0;
+	}
+	return ESP_OK;
+}
+
+esp_err_t dsps_biquad_gen_hpf_f32(float *coeffs, float f, float qFactor)
+{
+	float w0 = 2 * M_PI * f, c = cosf(w0), alpha = sinf(w0) / (2 * qFactor);
+	float a0 = 1 + alpha;
+
+	coeffs[0] = (1 + c) / 2 / a0;
+	coeffs[1] = -(1 + c) / a0;
+	coeffs[2] = coeffs[0];
+	coeffs[3] = -2 * c / a0;
+	coeffs[4] = (1 - alpha) / a0;
+	return ESP_OK;
+}
+
+esp_err_t dsps_biquad_gen_lowShelf_f32(float *coeffs, float f, float gain, float qFactor)
+{
+	float A = sqrtf(powf(10, gain / 20.0f)), w0 = 2 * M_PI * f, c = cosf(w0);
+	float alpha = sinf(w0) / (2 * qFactor), sa = 2 * sqrtf(A) * alpha;
+	float a0 = (A + 1) + (A - 1) * c + sa;
+
+	coeffs[0] = A * ((A + 1) - (A - 1) * c + sa) / a0;
+	coeffs[1] = 2 * A * ((A - 1) - (A + 1) * c) / a0;
+	coeffs[2] = A * ((A + 1) - (A - 1) * c - sa) / a0;
+	coeffs[3] = -2 * ((A - 1) + (A + 1) * c) / a0;
+	coeffs[4] = ((A + 1) + (A - 1) * c - sa) / a0;
+	return ESP_OK;
+}
+
+esp_err_t dsps_fft2r_fc32_ansi_(float *data, int N, float *w)
+{
+	int ie = 1, ia, m, i, j, N2;
+	float re, im, c, s;
+
+	for(N2 = N / 2; N2 > 0; N2 >>= 1){
+		ia = 0;
+		for(j = 0; j < ie; j++){
+			c = w[2 * j];
+			s = w[2 * j + 1];
+			for(i = 0; i < N2; i++){
+				m = ia + N2;
+				re = c * data[2 * m] + s * data[2 * m + 1];
+				im = c * data[2 * m + 1] - s * data[2 * m];
+				data[2 * m] = data[2 * ia] - re;
+				data[2 * m + 1] = data[2 * ia + 1] - im;
+				data[2 * ia] = data[2 * ia] + re;
+				data[2 * ia + 1] = data[2 * ia + 1] + im;
+				ia++;
+			}
+			ia += N2;
+		}
+		ie <<= 1;
+	}
+	return ESP_OK;
+}
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+#define TAG "SIM"
+
+// Runs app_main on the FreeRTOS POSIX port and plays one session against it:
+// connect the controller, lights on, default mode, Bluetooth mode, memory
+// report, disconnect. Then reports the firmware's own counters next to the
+// simulated hardware's and fails if the light path missed too many deadlines.
+//
+// usage: specbox_sim --sd DIR [--seconds N] [--a2dp FILE] [--drift PPM]
+//                    [--max-miss-permille N] [--quiet]
+#define APP_MAIN_STACK				8192
+#define SCENARIO_STACK				4096
+#define BOOT_WAIT_MS				3000
+#define SLEEP_WAIT_MS				15000
+
+extern void app_main(void);
+extern xTaskHandle s_app_task_handle;
+
+sim_options_t sim_opt = {
+	.sd_dir = NULL,
+	.a2dp_wav = "monoman.wav",
+	.seconds = 10,
+	.drift_ppm = 0,
+	.max_miss_permille = 20,
+};
+
+static mode_transition_t to_default, to_bluetooth;
+
+static void app_main_task(void *arg)
+{
+	app_main();
+	vTaskDelete(NULL);
+}
+
+static void command(const uint8_t *bytes, uint16_t len)
+{
+	sim_spp_send(bytes, len);
+	vTaskDelay(pdMS_TO_TICKS(500));
+}
+
+static void print_report(void)
+{
+	static const char* const phase[BOOT_PHASE_COUNT] = { "wake", "tasks", "prefetch", "analyzer", "servo",
+			"first audio", "first light" };
+	int i;
+
+	printf("\n==== specbox_sim report ====\n");
+	printf("light frames %u, misses %u | dispatch msgs %u, misses %u, max %u us\n",
+			deadline_stats.light_frames, deadline_stats.light_misses,
+			deadline_stats.dispatch_msgs, deadline_stats.dispatch_misses, deadline_stats.dispatch_max_us);
+	for(i = 0; i < LATENCY_PROFILE_COUNT; i++){
+		printf("profile %s: blocks %u, underruns %u, avg latency %u us\n", latency_profiles[i].name,
+				profile_stats[i].blocks, profile_stats[i].underruns,
+				profile_stats[i].blocks ? (uint32_t)(profile_stats[i].latency_us / profile_stats[i].blocks) : 0);
+	}
+	printf("ingress: sent %u, dropped %u (%u bytes), stretched %u\n",
+			ingress_stats.sent, ingress_stats.dropped, ingress_stats.dropped_bytes, ingress_stats.stretched);
+	printf("commands %u, avg %u us, max %u us\n", cmd_stats.commands,
+			cmd_stats.commands ? (uint32_t)(cmd_stats.total_us / cmd_stats.commands) : 0, cmd_stats.max_us);
+	for(i = 1; i < BOOT_PHASE_COUNT; i++){
+		if(boot_phase[i] != 0) printf("boot %s at +%u ms\n", phase[i], (uint32_t)((boot_phase[i] - boot_phase[BOOT_WAKE]) / 1000));
+	}
+	printf("to default: audio %u ms, settled %u ms | to bluetooth: audio %u ms, settled %u ms\n",
+			(uint32_t)(to_default.audio_us / 1000), (uint32_t)(to_default.settled_us / 1000),
+			(uint32_t)(to_bluetooth.audio_us / 1000), (uint32_t)(to_bluetooth.settled_us / 1000));
+	printf("sim i2s: %llu bytes in %u writes, %u underruns | a2dp blocks %u, stalls %u\n",
+			(unsigned long long)sim_stats.i2s_bytes, sim_stats.i2s_writes, sim_stats.i2s_underruns,
+			sim_stats.a2dp_blocks, sim_stats.a2dp_stalls);
+	printf("sim leds: %u refreshes, %u dac writes (last %u/%u), %u servo fades, %u spp bytes out\n",
+			sim_stats.led_refreshes, sim_stats.dac_writes, sim_stats.dac[0], sim_stats.dac[1],
+			sim_stats.servo_fades, sim_stats.spp_tx_bytes);
+	printf("sim nvs: %u commits, warm state saved %u times\n", sim_stats.nvs_commits, persist.writes);
+	printf("sim sd: %u multi-block reads, %u sectors\n", sim_stats.sd_reads, sim_stats.sd_sectors);
+}
+
+static void scenario_task(void *arg)
+{
+	const uint8_t light_on[] = { COMMAND_MODE_ACTIVE, LIGHT_ON };
+	const uint8_t def_mode[] = { COMMAND_MODE_ACTIVE, DEFAULT_MODE };
+	const uint8_t bt_mode[] = { COMMAND_MODE_ACTIVE, BLUETOOTH_MODE };
+	const uint8_t mem[] = { MEM_REPORT };
+	uint32_t waited = 0;
+	int rc = 0;
+
+	while(!sim_spp_listening()) vTaskDelay(pdMS_TO_TICKS(10));
+	ESP_LOGI(TAG, "Controller connects");
+	sim_spp_open();
+	vTaskDelay(pdMS_TO_TICKS(BOOT_WAIT_MS));
+
+	command(light_on, sizeof(light_on));
+	command(def_mode, sizeof(def_mode));
+	vTaskDelay(pdMS_TO_TICKS(sim_opt.seconds * 1000));
+	to_default = mode_transition;
+	command(bt_mode, sizeof(bt_mode));
+	vTaskDelay(pdMS_TO_TICKS(sim_opt.seconds * 1000));
+	to_bluetooth = mode_transition;
+	command(mem, sizeof(mem));
+
+	ESP_LOGI(TAG, "Controller disconnects");
+	sim_spp_close();
+	vTaskDelay(pdMS_TO_TICKS(500));
+	while(s_app_task_handle != NULL && waited < SLEEP_WAIT_MS){
+		vTaskDelay(pdMS_TO_TICKS(100));
+		waited += 100;
+	}
+	vTaskDelay(pdMS_TO_TICKS(200));
+
+	print_report();
+	if(s_app_task_handle != NULL){
+		printf("FAIL: the box did not go to sleep\n");
+		rc = 1;
+	}
+	if(deadline_stats.light_frames == 0){
+		printf("FAIL: no light frames\n");
+		rc = 1;
+	}
+	else if(deadline_stats.light_misses * 1000 > deadline_stats.light_frames * sim_opt.max_miss_permille){
+		printf("FAIL: %u of %u light frames missed their deadline\n", deadline_stats.light_misses,
+				deadline_stats.light_frames);
+		rc = 1;
+	}
+	fflush(stdout);
+	exit(rc);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s --sd DIR [--seconds N] [--a2dp FILE] [--drift PPM] "
+			"[--max-miss-permille N] [--quiet]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for(i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--quiet") == 0) sim_log_level = ESP_LOG_WARN;
+		else if(i + 1 == argc) usage(argv[0]);
+		else if(strcmp(argv[i], "--sd") == 0) sim_opt.sd_dir = argv[++i];
+		else if(strcmp(argv[i], "--seconds") == 0) sim_opt.seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--a2dp") == 0) sim_opt.a2dp_wav = argv[++i];
+		else if(strcmp(argv[i], "--drift") == 0) sim_opt.drift_ppm = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--max-miss-permille") == 0) sim_opt.max_miss_permille = atoi(argv[++i]);
+		else usage(argv[0]);
+	}
+	if(sim_opt.sd_dir == NULL) usage(argv[0]);
+
+	// stdout is shared by every task thread; keep lines whole
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	xTaskCreate(app_main_task, "main", APP_MAIN_STACK, NULL, 1, NULL);
+	xTaskCreate(scenario_task, "sim_scenario", SCENARIO_STACK, NULL, tskIDLE_PRIORITY + 1, NULL);
+	vTaskStartScheduler();
+	return 1;
+}
@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "sys/lock.h"
+
+// The pieces of ESP-IDF's FreeRTOS the upstream kernel does not have: TLS
+// delete callbacks, the byte ring buffer and newlib locks.
+
+//--------------------- TLS delete callbacks ----------------------
+// IDF runs the callback once the idle task has freed the deleted task. Here a
+// deletion is stamped with the idle pass it happened in and the callback runs
+// one full pass later, after the kernel's own cleanup.
+#define SIM_TLS_MAX					32
+
+typedef struct {
+	void *tcb;
+	BaseType_t index;
+	void *value;
+	TlsDeleteCallbackFunction_t cb;
+	uint32_t deleted;
+} sim_tls_t;
+
+static sim_tls_t tls_table[SIM_TLS_MAX];
+static uint32_t idle_pass = 1;
+
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t task, BaseType_t index, void *value,
+		TlsDeleteCallbackFunction_t cb)
+{
+	sim_tls_t *free_slot = NULL;
+	int i;
+
+	if(task == NULL) task = xTaskGetCurrentTaskHandle();
+	vTaskSetThreadLocalStoragePointer(task, index, value);
+	taskENTER_CRITICAL();
+	for(i = 0; i < SIM_TLS_MAX; i++){
+		if(tls_table[i].tcb == task && tls_table[i].deleted == 0 && tls_table[i].index == index){
+			free_slot = &tls_table[i];
+			break;
+		}
+		if(tls_table[i].tcb == NULL && free_slot == NULL) free_slot = &tls_table[i];
+	}
+	configASSERT(free_slot != NULL);
+	free_slot->tcb = task;
+	free_slot->index = index;
+	free_slot->value = value;
+	free_slot->cb = cb;
+	free_slot->deleted = 0;
+	taskEXIT_CRITICAL();
+}
+
+// traceTASK_DELETE, inside the kernel's critical section
+void sim_task_deleted(void *tcb)
+{
+	int i;
+	for(i = 0; i < SIM_TLS_MAX; i++){
+		if(tls_table[i].tcb == tcb && tls_table[i].deleted == 0) tls_table[i].deleted = idle_pass;
+	}
+}
+
+void vApplicationIdleHook(void)
+{
+	sim_tls_t due;
+	int i;
+
+	for(i = 0; i < SIM_TLS_MAX; i++){
+		taskENTER_CRITICAL();
+		due = tls_table[i];
+		if(due.tcb != NULL && due.deleted != 0 && due.deleted < idle_pass) tls_table[i].tcb = NULL;
+		else due.cb = NULL;
+		taskEXIT_CRITICAL();
+		if(due.cb != NULL) due.cb(due.index, due.value);
+	}
+	taskENTER_CRITICAL();
+	idle_pass += 1;
+	taskEXIT_CRITICAL();
+}
+
+//--------------------- Kernel task memory ------------------------
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *depth)
+{
+	static StaticTask_t idle_tcb;
+	static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+
+	*tcb = &idle_tcb;
+	*stack = idle_stack;
+	*depth = configMINIMAL_STACK_SIZE;
+}
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *depth)
+{
+	static StaticTask_t timer_tcb;
+	static StackType_t timer_stack[configTIMER_TASK_STACK_DEPTH];
+
+	*tcb = &timer_tcb;
+	*stack = timer_stack;
+	*depth = configTIMER_TASK_STACK_DEPTH;
+}
+
+//--------------------- Byte ring buffer --------------------------
+// State changes under the kernel critical section; waiters block on one
+// semaphore for data and one for space and re-check on every wake-up.
+static TickType_t ticks_left(TickType_t start, TickType_t ticks)
+{
+	TickType_t gone = xTaskGetTickCount() - start;
+	if(ticks == portMAX_DELAY) return portMAX_DELAY;
+	return gone >= ticks ? 0 : ticks - gone;
+}
+
+static void ring_init(StaticRingbuffer_t *r, uint8_t *storage, size_t size, bool dynamic)
+{
+	memset(r, 0, sizeof(*r));
+	r->storage = storage;
+	r->size = size;
+	r->dynamic = dynamic;
+	r->data_sem = xSemaphoreCreateBinaryStatic(&r->data_sem_buf);
+	r->space_sem = xSemaphoreCreateBinaryStatic(&r->space_sem_buf);
+}
+
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage, StaticRingbuffer_t *buf)
+{
+	configASSERT(type == RINGBUF_TYPE_BYTEBUF);
+	ring_init(buf, storage, size, false);
+	return buf;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type)
+{
+	StaticRingbuffer_t *r = malloc(sizeof(*r));
+	uint8_t *storage = malloc(size);
+
+	configASSERT(type == RINGBUF_TYPE_BYTEBUF);
+	if(r == NULL || storage == NULL){
+		free(r);
+		free(storage);
+		return NULL;
+	}
+	ring_init(r, storage, size, true);
+	return r;
+}
+
+void vRingbufferDelete(RingbufHandle_t ring)
+{
+	StaticRingbuffer_t *r = ring;
+
+	vSemaphoreDelete(r->data_sem);
+	vSemaphoreDelete(r->space_sem);
+	if(r->dynamic){
+		free(r->storage);
+		free(r);
+	}
+}
+
+UBaseType_t xRingbufferSend(RingbufHandle_t ring, const void *data, size_t size, TickType_t ticks)
+{
+	StaticRingbuffer_t *r = ring;
+	TickType_t start = xTaskGetTickCount(), left = ticks;
+	size_t head, first;
+
+	if(size > r->size) return pdFALSE;
+	while(true){
+		taskENTER_CRITICAL();
+		if(r->size - r->used >= size){
+			head = (r->read + r->used) % r->size;
+			first = size < r->size - head ? size : r->size - head;
+			memcpy(r->storage + head, data, first);
+			memcpy(r->storage, (const uint8_t *)data + first, size - first);
+			r->used += size;
+			taskEXIT_CRITICAL();
+			xSemaphoreGive(r->data_sem);
+			return pdTRUE;
+		}
+		taskEXIT_CRITICAL();
+		if(left == 0) return pdFALSE;
+		xSemaphoreTake(r->space_sem, left);
+		left = ticks_left(start, ticks);
+	}
+}
+
+// Returns the longest contiguous run of unread bytes, up to max_size
+void *xRingbufferReceiveUpTo(RingbufHandle_t ring, size_t *size, TickType_t ticks, size_t max_size)
+{
+	StaticRingbuffer_t *r = ring;
+	TickType_t start = xTaskGetTickCount(), left = ticks;
+	void *item;
+	size_t n;
+
+	while(true){
+		taskENTER_CRITICAL();
+		if(r->held == 0 && r->used > 0){
+			n = r->used < r->size - r->read ? r->used : r->size - r->read;
+			if(n > max_size) n = max_size;
+			r->held = n;
+			item = r->storage + r->read;
+			taskEXIT_CRITICAL();
+			*size = n;
+			return item;
+		}
+		taskEXIT_CRITICAL();
+		if(left == 0) return NULL;
+		xSemaphoreTake(r->data_sem, left);
+		left = ticks_left(start, ticks);
+	}
+}
+
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *size, TickType_t ticks)
+{
+	return xRingbufferReceiveUpTo(ring, size, ticks, ((StaticRingbuffer_t *)ring)->size);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item)
+{
+	StaticRingbuffer_t *r = ring;
+
+	taskENTER_CRITICAL();
+	configASSERT(item == r->storage + r->read && r->held > 0);
+	r->read = (r->read + r->held) % r->size;
+	r->used -= r->held;
+	r->held = 0;
+	taskEXIT_CRITICAL();
+	xSemaphoreGive(r->space_sem);
+	xSemaphoreGive(r->data_sem);
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ring)
+{
+	StaticRingbuffer_t *r = ring;
+	size_t n;
+
+	taskENTER_CRITICAL();
+	n = r->size - r->used;
+	taskEXIT_CRITICAL();
+	return n;
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t ring)
+{
+	return ((StaticRingbuffer_t *)ring)->size;
+}
+
+//--------------------- newlib locks ------------------------------
+void _lock_acquire(_lock_t *lock)
+{
+	if(*lock == 0){
+		taskENTER_CRITICAL();
+		if(*lock == 0) *lock = (_lock_t)xSemaphoreCreateMutex();
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreTake((SemaphoreHandle_t)*lock, portMAX_DELAY);
+}
+
+void _lock_release(_lock_t *lock)
+{
+	xSemaphoreGive((SemaphoreHandle_t)*lock);
+}
@@ -0,0 +1,242 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "sync_proto.h"
+
+// sync_proto on a loopback: one leader and N followers in virtual time, each
+// with its own clock offset and drift, the controller's relay standing in as
+// a broadcast with latency, jitter and loss. The leader sends a frame per
+// audio block; followers poll at the color task's tick, ping and show frames
+// from their jitter buffer. Reports the followers' clock offset error, how far
+// their frames land from the leader's, late/skipped frames and the bytes each
+// unit moves, and fails past the given show error or loss.
+//
+// usage: sync_loop [--followers N] [--seconds N] [--latency-ms N] [--jitter-ms N]
+//                  [--loss-permille N] [--drift-ppm N] [--seed N]
+//                  [--max-error-ms N] [--max-loss-permille N]
+#define MAX_UNITS					8
+#define MAX_PACKETS					4096
+#define STEP_US						1000
+#define TICK_US						10000			// color task wake-up, 100 Hz
+#define FRAME_US					23220			// 1024 samples at 44.1 kHz
+#define PIPE_US						120000			// leader's audio reaches its DAC
+#define LATE_US						(4096 * 250000LL / 44100)	// LIGHT_DEADLINE_US
+#define SETTLE_US					5000000
+#define OFFSET_SPREAD_US			3600000000LL	// boxes woke up to an hour apart
+
+typedef struct {
+	int64_t at;						// true time of delivery
+	uint8_t to;
+	uint8_t len;
+	uint8_t msg[SYNC_MSG_MAX];
+} packet_t;
+
+typedef struct {
+	sync_node_t n;
+	sync_transport_t tp;
+	int64_t offset_us;
+	int32_t drift_ppm;
+	int64_t last_ping;
+	int64_t tick_phase;
+} unit_t;
+
+static struct {
+	int followers;
+	int seconds;
+	int latency_ms;
+	int jitter_ms;
+	int loss_permille;
+	int drift_ppm;
+	uint32_t seed;
+	int max_error_ms;
+	int max_loss_permille;
+} opt = { 3, 60, 20, 15, 10, 40, 1, 5, 20 };
+
+static unit_t units[MAX_UNITS];
+static int n_units;
+static packet_t packets[MAX_PACKETS];
+static int n_packets;
+static int64_t t_now;
+static uint32_t rng;
+static uint32_t relay_dropped;
+
+static uint32_t rnd(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static int64_t local_time(const unit_t *u, int64_t t)
+{
+	return u->offset_us + t + t * u->drift_ppm / 1000000;
+}
+
+// true time at which u's clock reads l
+static int64_t true_time(const unit_t *u, int64_t l)
+{
+	return (int64_t)((double)(l - u->offset_us) / (1.0 + u->drift_ppm * 1e-6));
+}
+
+// the controller relays every message to every other unit
+static void relay_send(void *ctx, const uint8_t *msg, size_t len)
+{
+	int from = (int)(intptr_t)ctx, i;
+	packet_t *p;
+
+	for(i = 0; i < n_units; i++){
+		if(i == from) continue;
+		if(rnd() % 1000 < (uint32_t)opt.loss_permille || n_packets == MAX_PACKETS){
+			relay_dropped += 1;
+			continue;
+		}
+		p = &packets[n_packets++];
+		p->at = t_now + opt.latency_ms * 1000LL + (opt.jitter_ms ? rnd() % (opt.jitter_ms * 1000) : 0);
+		p->to = i;
+		p->len = len;
+		memcpy(p->msg, msg, len);
+	}
+}
+
+static int64_t unit_clock(void *ctx)
+{
+	return local_time(&units[(intptr_t)ctx], t_now);
+}
+
+static void deliver(void)
+{
+	int i = 0;
+
+	while(i < n_packets){
+		if(packets[i].at <= t_now){
+			sync_rx(&units[packets[i].to].n, packets[i].msg, packets[i].len, local_time(&units[packets[i].to], packets[i].at));
+			packets[i] = packets[--n_packets];
+		}
+		else i++;
+	}
+}
+
+static int cmp_abs(const void *a, const void *b)
+{
+	int64_t x = llabs(*(const int64_t*)a), y = llabs(*(const int64_t*)b);
+	return (x > y) - (x < y);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--followers N] [--seconds N] [--latency-ms N] [--jitter-ms N] "
+			"[--loss-permille N] [--drift-ppm N] [--seed N] [--max-error-ms N] [--max-loss-permille N]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static int64_t leader_show[256];
+	int64_t *err, offset_err_max = 0, e, next_frame = 0, end, settled_tx = 0;
+	size_t n_err = 0, cap;
+	uint32_t settled_shown = 0, settled_expected = 0, loss;
+	sync_frame_t f;
+	const uint8_t bands[SYNC_BANDS] = { 0 };
+	uint8_t seq;
+	unit_t *u;
+	int i;
+	bool fail;
+
+	for(i = 1; i < argc; i++){
+		if(i + 1 == argc) usage(argv[0]);
+		else if(strcmp(argv[i], "--followers") == 0) opt.followers = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--seconds") == 0) opt.seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--latency-ms") == 0) opt.latency_ms = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--jitter-ms") == 0) opt.jitter_ms = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--loss-permille") == 0) opt.loss_permille = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--drift-ppm") == 0) opt.drift_ppm = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--seed") == 0) opt.seed = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(argv[i], "--max-error-ms") == 0) opt.max_error_ms = atoi(argv[++i]);
+		else if(strcmp(argv[i], "--max-loss-permille") == 0) opt.max_loss_permille = atoi(argv[++i]);
+		else usage(argv[0]);
+	}
+	if(opt.followers < 1 || opt.followers >= MAX_UNITS || opt.seconds * 1000000LL <= SETTLE_US) usage(argv[0]);
+
+	rng = opt.seed ? opt.seed : 1;
+	n_units = opt.followers + 1;
+	for(i = 0; i < n_units; i++){
+		u = &units[i];
+		u->tp.ctx = (void*)(intptr_t)i;
+		u->tp.send = relay_send;
+		u->tp.clock = unit_clock;
+		u->offset_us = i == 0 ? 0 : rnd() % OFFSET_SPREAD_US;
+		u->drift_ppm = i == 0 ? 0 : (int32_t)(rnd() % (2 * opt.drift_ppm + 1)) - opt.drift_ppm;
+		u->tick_phase = rnd() % TICK_US;
+		sync_init(&u->n, i == 0 ? SYNC_ROLE_LEADER : SYNC_ROLE_FOLLOWER, i, &u->tp,
+				CONFIG_SPECBOX_SYNC_PLAYOUT_MS * 1000LL, LATE_US);
+	}
+
+	end = opt.seconds * 1000000LL;
+	cap = (size_t)(end / FRAME_US + 1) * opt.followers;
+	err = malloc(cap * sizeof(*err));
+	if(err == NULL) return 1;
+
+	for(t_now = 0; t_now < end; t_now += STEP_US){
+		deliver();
+		if(t_now >= next_frame){
+			// the frame's audio reaches the leader's DAC PIPE_US from now
+			u = &units[0];
+			seq = u->n.frame_seq;
+			leader_show[seq] = true_time(u, sync_send_frame(&u->n, local_time(u, t_now) + PIPE_US, bands));
+			next_frame += FRAME_US;
+			if(t_now >= SETTLE_US) settled_tx += 1;
+		}
+		for(i = 1; i < n_units; i++){
+			int64_t now;
+
+			u = &units[i];
+			if((t_now + u->tick_phase) % TICK_US >= STEP_US) continue;
+			// as sync_link_poll and sync_link_follow
+			now = local_time(u, t_now);
+			if(now - u->last_ping >= (sync_synced(&u->n) ? CONFIG_SPECBOX_SYNC_PING_MS : CONFIG_SPECBOX_SYNC_PING_MS / 4) * 1000LL){
+				u->last_ping = now;
+				sync_send_ping(&u->n, now);
+			}
+			if(!sync_following(&u->n, now) || !sync_pop(&u->n, now + TICK_US, &f)) continue;
+			if(t_now < SETTLE_US) continue;
+			// the light queue holds it until due
+			e = true_time(u, f.due > now ? f.due : now) - leader_show[f.seq];
+			if(n_err < cap) err[n_err++] = e;
+			settled_shown += 1;
+			e = u->n.offset - (local_time(&units[0], t_now) - now);
+			if(llabs(e) > offset_err_max) offset_err_max = llabs(e);
+		}
+	}
+
+	settled_expected = settled_tx * opt.followers;
+	loss = settled_expected ? (uint32_t)((settled_expected - (settled_shown < settled_expected ? settled_shown : settled_expected)) * 1000 / settled_expected) : 1000;
+	qsort(err, n_err, sizeof(*err), cmp_abs);
+
+	printf("\n==== sync_loop report ====\n");
+	printf("%d followers, %d s, relay latency %d ms + jitter %d ms, loss %d permille, drift +-%d ppm\n",
+			opt.followers, opt.seconds, opt.latency_ms, opt.jitter_ms, opt.loss_permille, opt.drift_ppm);
+	printf("after %d s: clock offset error max %lld us\n", SETTLE_US / 1000000, (long long)offset_err_max);
+	if(n_err){
+		printf("show error vs leader: median %lld us, p99 %lld us, max %lld us\n", (long long)llabs(err[n_err / 2]),
+				(long long)llabs(err[n_err * 99 / 100]), (long long)llabs(err[n_err - 1]));
+	}
+	printf("frames shown %u of %lld (%u permille lost), relay dropped %u messages\n",
+			settled_shown, (long long)settled_expected, loss, relay_dropped);
+	for(i = 0; i < n_units; i++){
+		u = &units[i];
+		printf("unit %d %s: drift %d ppm, tx %u B/s, rx %u B/s, shown %u, late %u, skipped %u, pings %u, pongs %u, rtt %lld us\n",
+				i, i == 0 ? "leader  " : "follower", u->drift_ppm, u->n.stats.tx_bytes / opt.seconds,
+				u->n.stats.rx_bytes / opt.seconds, u->n.stats.frames_shown, u->n.stats.frames_late,
+				u->n.stats.frames_skipped, u->n.stats.pings, u->n.stats.pongs, (long long)u->n.rtt);
+	}
+
+	fail = n_err == 0 || llabs(err[n_err * 99 / 100]) > opt.max_error_ms * 1000LL || loss > (uint32_t)opt.max_loss_permille;
+	printf("%s\n", fail ? "FAIL" : "PASS");
+	free(err);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+import struct
+import sys
+
+import numpy as np
+
+from trace_replay import Analyzer
+
+# Generates the light-track sidecar (.lgt) that play_default reads next to the
+# default track, so the firmware can skip the live FFT for it. The bands come
+# from trace_replay's port of the process_colors analysis (no window, |re| + |im|
+# of the unreordered FFT, triangular bands on spi[]), computed over the same
+# blocks play_default streams: 4096 bytes at a time from just past the 44-byte
+# header, whatever the WAV's chunk layout.
+#
+# Layout (little endian):
+#   header : magic 'LTRK', version, n_bands, steps per octave, reserved,
+#            hop bytes, data offset, frame count
+#   frames : n_frames * n_bands quantized band energies, q = log2(1 + E) * SCALE
+
+MAGIC = b'LTRK'
+VERSION = 1
+HEADER = '<4sBBBBIII'
+
+DATA_OFFSET = 44
+HOP_BYTES = 4096
+SCALE = 8
+K = 9
+
+
+def main(wav, out):
+    with open(wav, 'rb') as f:
+        raw = f.read()[DATA_OFFSET:]
+    n_frames = len(raw) // HOP_BYTES
+    analyzer = Analyzer(K)
+
+    frames = np.zeros((n_frames, K), dtype=np.uint8)
+    for n in range(n_frames):
+        analyzer.fft_bands(raw[n * HOP_BYTES:(n + 1) * HOP_BYTES])
+        frames[n] = np.clip(np.rint(np.log2(1.0 + analyzer.CD.astype(np.float64)) * SCALE), 0, 255)
+
+    with open(out, 'wb') as f:
+        f.write(struct.pack(HEADER, MAGIC, VERSION, K, SCALE, 0, HOP_BYTES, DATA_OFFSET, n_frames))
+        f.write(frames.tobytes())
+    print('%s: %d frames, %d bytes' % (out, n_frames, struct.calcsize(HEADER) + frames.size))
+
+
+if __name__ == '__main__':
+    src = sys.argv[1] if len(sys.argv) > 1 else 'monoman.wav'
+    main(src, sys.argv[2] if len(sys.argv) > 2 else src.rsplit('.', 1)[0] + '.lgt')
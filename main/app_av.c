@@ -59,7 +59,10 @@ void bt_app_a2d_cb(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *param)
 
 void bt_app_a2d_data_cb(const uint8_t *data, uint32_t len)
 {
-    write_ringbuf(data, len);
+    if (MODE != BLUETOOTH_MODE) {
+        return;
+    }
+    write_ringbuf_nb(data, len);
 }
 
 void bt_app_alloc_meta_buffer(esp_avrc_ct_cb_param_t *param)
@@ -119,6 +122,7 @@ static void bt_av_hdl_a2d_evt(uint16_t event, void *p_param)
         uint8_t *bda = a2d->conn_stat.remote_bda;
         ESP_LOGI(BT_AV_TAG, "A2DP connection state: %s, [%02x:%02x:%02x:%02x:%02x:%02x]",
              s_a2d_conn_state_str[a2d->conn_stat.state], bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+        mode_a2d_event(event, a2d);
         break;
     }
     case ESP_A2D_AUDIO_STATE_EVT: {
@@ -162,6 +166,7 @@ static void bt_av_hdl_a2d_evt(uint16_t event, void *p_param)
         } else {
             ESP_LOGI(BT_AV_TAG,"A2DP PROF STATE: Deinit Complete\n");
         }
+        mode_a2d_event(event, a2d);
         break;
     }
     default:
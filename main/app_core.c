@@ -1,7 +1,9 @@
 #include <app_core.h>
 #include <app_av.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include "freertos/xtensa_api.h"
 #include "freertos/semphr.h"
@@ -11,6 +13,9 @@
 #include "esp_log.h"
 #include "driver/i2s.h"
 #include "freertos/ringbuf.h"
+#include "freertos/stream_buffer.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #include "esp_bt.h"
 #include "esp_bt_main.h"
@@ -22,14 +27,94 @@
 
 #define TAG "APP_CORE"
 
+#define AUDIO_CHANNEL_SIZE		8192
+#define UNDERRUN_WINDOW_US		500000
+#define PROFILE_SWITCH_MS		500
+#define SLOT_FREE_MS			500
+
+#define DRIFT_MARGIN			16
+#define DRIFT_TARGET_FILL		(ring_cap() / 2)
+#define DRIFT_KP				1e-3f
+#define DRIFT_KI				1e-6f
+#define DRIFT_FILL_ALPHA		0.01f
+
+#define ENV_QUEUE_LEN			16
+#define ENV_FLOOR_DB			-48.0f
+// a sine's peak square is twice its mean square: steady tones read as their
+// RMS, transients with a higher crest factor read above it
+#define ENV_PEAK_WEIGHT			0.5f
+#define NEON_FLOOR				35
+#if CONFIG_SPECBOX_ENVELOPE_BENCH
+#define ENV_BENCH_BLOCKS		256
+#endif
+
+#define APP_QUEUE_LEN			10
+
+#define STACK_DISPATCH			8192
+#define STACK_I2S				6144
+#define STACK_DEFAULT			4096
+// process_colors' own frame is about 0.75 KB with the trace on (host
+// -fstack-usage); with beat_spectrum and an ESP_LOGx or SPP sync frame below
+// it the peak is estimated at 3.5 KB. mem_sample warns when a slot gets close.
+#define STACK_COLOR				5120
+#define STACK_CMD				3072
+#define STACK_SENSOR			2048
+#define STACK_SERVO				2048
+#if CONFIG_SPECBOX_STRESS_BENCH
+#define STACK_STRESS			2560
+#else
+#define STACK_STRESS			0
+#endif
+#define STACK_WARN				512
+#define TASK_STACK_POOL			(STACK_DISPATCH + STACK_I2S + STACK_DEFAULT + STACK_COLOR + \
+								 STACK_CMD + STACK_SENSOR + STACK_SERVO + STACK_STRESS)
+
 static void app_task_handler(void *arg);
+static void i2s_task_handler(void *arg);
 static bool app_send_msg(app_msg_t *msg);
 static void app_work_dispatched(app_msg_t *msg);
-static uint8_t* col_data;
-static uint8_t* audio_data;
+
+// Everything a wake cycle needs is reserved once here and reused, so repeated
+// wake/sleep leaves the heap to the Bluetooth stack.
+typedef struct {
+	StackType_t stacks[TASK_STACK_POOL];
+	StaticTask_t tcb[TASK_COUNT];
+	uint8_t app_queue[APP_QUEUE_LEN * sizeof(app_msg_t)];
+	StaticQueue_t app_queue_buf;
+	uint8_t ring[AUDIO_CHANNEL_SIZE];
+	StaticRingbuffer_t ring_buf;
+	uint8_t cmd_stream[CMD_STREAM_SIZE + 1];
+	StaticStreamBuffer_t cmd_stream_buf;
+	StaticSemaphore_t cdat_sem;
+	StaticSemaphore_t cmd_rx_lock;
+	StaticSemaphore_t cmd_rx_sem;
+	StaticSemaphore_t drain_sem;
+	StaticSemaphore_t ring_space;
+	StaticSemaphore_t profile_done;
+	StaticEventGroup_t exit_group;
+	uint8_t col_data[CSIZE];
+	uint8_t audio_data[CSIZE + DRIFT_MARGIN];
+} app_arena_t;
+
+static app_arena_t arena;
+static bool arena_ready = false;
+static uint32_t stack_offset[TASK_COUNT];
+static volatile bool slot_busy[TASK_COUNT];
+static xTaskHandle slot_task[TASK_COUNT];
+mem_stats_t mem_stats;
+static uint32_t stack_warned = 0;
+
+static uint8_t* const col_data = arena.col_data;
+static uint8_t* const audio_data = arena.audio_data;
 RingbufHandle_t audio_channel;
 
-xQueueHandle command_queue;
+StreamBufferHandle_t command_stream;
+static xSemaphoreHandle cmd_rx_lock;
+xSemaphoreHandle cmd_rx_sem;
+// arrival of the first byte queued into an empty stream; 64 bits, so it is
+// read and written under cmd_rx_stamp_lock as col_due is
+static int64_t cmd_rx_stamp;
+static portMUX_TYPE cmd_rx_stamp_lock = portMUX_INITIALIZER_UNLOCKED;
 xQueueHandle s_app_task_queue;
 
 xSemaphoreHandle cdat_semaphore;
@@ -40,8 +125,106 @@ xTaskHandle sensor_handle;
 xTaskHandle command_handle;
 xTaskHandle def_handle;
 xTaskHandle color_handle;
+xTaskHandle servo_handle;
+static EventGroupHandle_t task_exit_group;
+static xSemaphoreHandle drain_sem;
+static xSemaphoreHandle ring_space;
+static xSemaphoreHandle profile_done;
+static EventBits_t cmpl_bits;
+static volatile bool i2s_stopping = false;
+static bool i2s_held = false;
+
+// Bluetooth host and dispatcher work stays on the controller's core, audio and
+// DSP go to the other one. Priorities put the DAC feed above its producers and
+// the light analysis below both.
+#if CONFIG_SPECBOX_TASK_PLACEMENT_PINNED
+#define PLACEMENT_NAME		"pinned"
+#define CONTROL_CORE		CONFIG_SPECBOX_CONTROL_CORE
+#define AUDIO_CORE			CONFIG_SPECBOX_AUDIO_CORE
+static const task_slot_t task_table[TASK_COUNT] = {
+	[TASK_DISPATCH]	= { "BtAppT",		app_task_handler,	STACK_DISPATCH,	CONFIG_SPECBOX_PRIO_DISPATCH,	CONTROL_CORE },
+	[TASK_I2S]		= { "BtI2ST",		i2s_task_handler,	STACK_I2S,		CONFIG_SPECBOX_PRIO_I2S,		AUDIO_CORE },
+	[TASK_DEFAULT]	= { "default_task",	play_default,		STACK_DEFAULT,	CONFIG_SPECBOX_PRIO_DEFAULT,	AUDIO_CORE },
+	[TASK_COLOR]	= { "color_task",	process_colors,		STACK_COLOR,	CONFIG_SPECBOX_PRIO_COLOR,		AUDIO_CORE },
+	[TASK_CMD]		= { "cmd_task",		cmd_cb_task,		STACK_CMD,		CONFIG_SPECBOX_PRIO_CMD,		CONTROL_CORE },
+	[TASK_SENSOR]	= { "sensor_task",	sensor_task,		STACK_SENSOR,	CONFIG_SPECBOX_PRIO_SENSOR,		CONTROL_CORE },
+	[TASK_SERVO]	= { "servo_task",	servo_task,			STACK_SERVO,	CONFIG_SPECBOX_PRIO_SENSOR,		CONTROL_CORE },
+#if CONFIG_SPECBOX_STRESS_BENCH
+	[TASK_STRESS]	= { "stress_task",	stress_task,		STACK_STRESS,	1,								CONTROL_CORE },
+#endif
+};
+#else
+#define PLACEMENT_NAME		"legacy"
+static const task_slot_t task_table[TASK_COUNT] = {
+	[TASK_DISPATCH]	= { "BtAppT",		app_task_handler,	STACK_DISPATCH,	configMAX_PRIORITIES - 3,	tskNO_AFFINITY },
+	[TASK_I2S]		= { "BtI2ST",		i2s_task_handler,	STACK_I2S,		tskIDLE_PRIORITY,			tskNO_AFFINITY },
+	[TASK_DEFAULT]	= { "default_task",	play_default,		STACK_DEFAULT,	5,							tskNO_AFFINITY },
+	[TASK_COLOR]	= { "color_task",	process_colors,		STACK_COLOR,	tskIDLE_PRIORITY,			tskNO_AFFINITY },
+	[TASK_CMD]		= { "cmd_task",		cmd_cb_task,		STACK_CMD,		1,							tskNO_AFFINITY },
+	[TASK_SENSOR]	= { "sensor_task",	sensor_task,		STACK_SENSOR,	3,							tskNO_AFFINITY },
+	[TASK_SERVO]	= { "servo_task",	servo_task,			STACK_SERVO,	3,							tskNO_AFFINITY },
+#if CONFIG_SPECBOX_STRESS_BENCH
+	[TASK_STRESS]	= { "stress_task",	stress_task,		STACK_STRESS,	1,							tskNO_AFFINITY },
+#endif
+};
+#endif
+
+deadline_stats_t deadline_stats;
+
+static const char *boot_phase_name[BOOT_PHASE_COUNT] = {
+	"wake", "tasks up", "prefetch", "analyzer", "servo", "first audio", "first light"
+};
+int64_t boot_phase[BOOT_PHASE_COUNT];
 
 bool STL_STATE = false;
+bool TRK_STATE = false;
+uint8_t col_track[HN_LED];
+// 64 bits do not store in one access on the ESP32: the due time of the block in
+// col_data is read and written under col_due_lock
+static int64_t col_due;
+static portMUX_TYPE col_due_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile size_t i2s_pending = 0;
+static size_t i2s_dma_bytes = 0;
+
+// The ring level and the receive timeout follow the active profile at once; a
+// different DMA geometry means reinstalling the driver, see apply_latency_profile.
+const latency_profile_t latency_profiles[LATENCY_PROFILE_COUNT] = {
+	{ "low",	4,	256,	4096,	10 },
+	{ "robust",	10,	512,	8192,	30 },
+};
+uint8_t latency_profile = CONFIG_SPECBOX_DEFAULT_LATENCY_PROFILE;
+profile_stats_t profile_stats[LATENCY_PROFILE_COUNT];
+static volatile int8_t profile_request = -1;
+
+uint8_t drift_fill = 0;
+int32_t drift_ppm = 0;
+static float drift_pos, drift_avg, drift_integ, drift_step = 1.0f;
+static int16_t drift_prev[2];
+
+// Peak/RMS output level per channel. The gain pass sums the squares and keeps
+// the largest; the mean square gets attack/release once per block, the peak
+// square is taken at once and released at the same rate, and the louder of the
+// two sets the level. Each block's level waits in env_queue until its audio has
+// left the DMA chain.
+typedef struct {
+	int64_t due;
+	uint8_t level[2];
+} env_point_t;
+
+uint8_t env_level[2];
+static float env_ms[2], env_pk[2];
+// per-frame rates, 1 / (time constant in frames)
+static float env_atk, env_rel, env_rate;
+static env_point_t env_queue[ENV_QUEUE_LEN];
+static uint8_t env_head, env_count;
+#if CONFIG_SPECBOX_NEON_ENVELOPE
+static bool neon_live = false;
+#endif
+#if CONFIG_SPECBOX_DSP_CHAIN
+static float chain_volume;
+#endif
+
+ingress_stats_t ingress_stats;
 
 bool app_work_dispatch(app_cb_t p_cback, uint16_t event, void *p_params, int param_len)
 {
@@ -53,6 +236,7 @@ bool app_work_dispatch(app_cb_t p_cback, uint16_t event, void *p_params, int par
     msg.sig = APP_SIG_WORK_DISPATCH;
     msg.event = event;
     msg.cb = p_cback;
+    msg.stamp = esp_timer_get_time();
 
     if (param_len == 0) {
         return app_send_msg(&msg);
@@ -81,9 +265,32 @@ static bool app_send_msg(app_msg_t *msg)
 
 static void app_work_dispatched(app_msg_t *msg)
 {
+    uint32_t wait = esp_timer_get_time() - msg->stamp;
+
+    deadline_stats.dispatch_msgs += 1;
+    if (wait > deadline_stats.dispatch_max_us) deadline_stats.dispatch_max_us = wait;
+    if (wait > DISPATCH_DEADLINE_US) deadline_stats.dispatch_misses += 1;
     if (msg->cb) {
         msg->cb(msg->event, msg->param);
     }
+#if CONFIG_SPECBOX_TRACE
+    trc_dispatch_t d = { msg->event, (uint32_t)(uintptr_t)msg->cb, wait, 0 };
+    d.run_us = esp_timer_get_time() - msg->stamp - wait;
+    trace_put(TRC_DISPATCH, 0, &d, sizeof(d));
+#endif
+}
+
+static void app_work_drained(uint16_t event, void *param)
+{
+	xSemaphoreGive(drain_sem);
+}
+
+// Returns once everything dispatched before the call has run
+bool app_work_drain(uint32_t timeout_ms)
+{
+	xSemaphoreTake(drain_sem, 0);
+	if(!app_work_dispatch(app_work_drained, 0, NULL, 0)) return false;
+	return xSemaphoreTake(drain_sem, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
 }
 
 static void app_task_handler(void *arg)
@@ -96,6 +303,10 @@ static void app_task_handler(void *arg)
             case APP_SIG_WORK_DISPATCH:
                 app_work_dispatched(&msg);
                 break;
+            case APP_SIG_STOP:
+                s_app_task_handle = NULL;
+                task_exit(TASK_DISPATCH);
+                break;
             default:
                 ESP_LOGW(TAG, "%s, unhandled sig: %d", __func__, msg.sig);
                 break;
@@ -108,58 +319,278 @@ static void app_task_handler(void *arg)
     }
 }
 
+int64_t get_cmd_rx_stamp(void)
+{
+	int64_t stamp;
+
+	portENTER_CRITICAL(&cmd_rx_stamp_lock);
+	stamp = cmd_rx_stamp;
+	portEXIT_CRITICAL(&cmd_rx_stamp_lock);
+	return stamp;
+}
+
+// Command ingress from SPP (and the stress benchmark). Never waits for space:
+// bytes that don't fit are counted and dropped.
+void cmd_rx(const uint8_t *data, size_t len)
+{
+	size_t n = 0;
+	if(command_stream == NULL) return;
+	if(xSemaphoreTake(cmd_rx_lock, 1) == pdTRUE){
+		if(xStreamBufferIsEmpty(command_stream)){
+			portENTER_CRITICAL(&cmd_rx_stamp_lock);
+			cmd_rx_stamp = esp_timer_get_time();
+			portEXIT_CRITICAL(&cmd_rx_stamp_lock);
+		}
+		n = xStreamBufferSend(command_stream, data, len, 0);
+		xSemaphoreGive(cmd_rx_lock);
+	}
+	cmd_rx_dropped += len - n;
+#if CONFIG_SPECBOX_TRACE
+	trace_put(TRC_CMD, 0, data, len);
+#endif
+	if(n > 0) xSemaphoreGive(cmd_rx_sem);
+}
+
+// Runs from the idle task once a deleted task's TCB is no longer referenced
+static void task_slot_freed(int index, void *slot)
+{
+	slot_busy[(uintptr_t)slot] = false;
+}
+
+// The previous instance may have exited but not been cleaned up yet. A slot
+// still busy after SLOT_FREE_MS holds a task that never exited, whose stack and
+// TCB must not be reused.
+static bool slot_wait(uint8_t id)
+{
+	TickType_t t0 = xTaskGetTickCount();
+
+	while(slot_busy[id]){
+		if(xTaskGetTickCount() - t0 > pdMS_TO_TICKS(SLOT_FREE_MS)){
+			ESP_LOGE(TAG, "Slot of %s still in use", task_table[id].name);
+			return false;
+		}
+		vTaskDelay(1);
+	}
+	return true;
+}
+
+bool start_task(uint8_t id, void *arg, xTaskHandle *handle)
+{
+	const task_slot_t *t = &task_table[id];
+	xTaskHandle task;
+
+	if(!slot_wait(id)){
+		if(handle != NULL) *handle = NULL;
+		return false;
+	}
+	xEventGroupClearBits(task_exit_group, TASK_BIT(id));
+	slot_busy[id] = true;
+	task = xTaskCreateStaticPinnedToCore(t->fn, t->name, t->stack, arg, t->prio,
+			arena.stacks + stack_offset[id], &arena.tcb[id], t->core);
+	if(task == NULL){
+		slot_busy[id] = false;
+		ESP_LOGE(TAG, "Can't start %s", t->name);
+	}
+	else vTaskSetThreadLocalStoragePointerAndDelCallback(task, 0, (void *)(uintptr_t)id, task_slot_freed);
+	slot_task[id] = task;
+	if(handle != NULL) *handle = task;
+	return task != NULL;
+}
+
+// Keeps the lowest stack headroom seen per task slot since boot, plus heap figures
+void mem_sample(void)
+{
+	uint32_t hwm;
+	int i;
+
+	for(i = 0; i < TASK_COUNT; i++){
+		if(!slot_busy[i]) continue;
+		hwm = uxTaskGetStackHighWaterMark(slot_task[i]);
+		if(mem_stats.stack_free[i] == 0 || hwm < mem_stats.stack_free[i]) mem_stats.stack_free[i] = hwm;
+		if(hwm < STACK_WARN && !(stack_warned & TASK_BIT(i))){
+			stack_warned |= TASK_BIT(i);
+			ESP_LOGW(TAG, "%s: %u of %u stack bytes left", task_table[i].name, hwm, task_table[i].stack);
+		}
+	}
+	mem_stats.internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	mem_stats.internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	mem_stats.internal_min = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	mem_stats.spiram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+int mem_report(char *buf, size_t len)
+{
+	int n, i;
+
+	mem_sample();
+	n = snprintf(buf, len, "heap %u largest %u min %u psram %u arena %zu dsp %zu\n",
+			mem_stats.internal_free, mem_stats.internal_largest, mem_stats.internal_min,
+			mem_stats.spiram_free, sizeof(arena), dsp_work_size);
+	for(i = 0; i < TASK_COUNT && n < len; i++){
+		n += snprintf(buf + n, len - n, "%s %u/%u\n", task_table[i].name,
+				mem_stats.stack_free[i], task_table[i].stack);
+	}
+	return n < len ? n : len - 1;
+}
+
+// Called by a worker in place of vTaskDelete(NULL), after it has released
+// everything it holds.
+void task_exit(uint8_t id)
+{
+	xEventGroupSetBits(task_exit_group, TASK_BIT(id));
+	vTaskDelete(NULL);
+}
+
+bool task_join(EventBits_t bits, uint32_t timeout_ms)
+{
+	EventBits_t got = xEventGroupWaitBits(task_exit_group, bits, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+	if((got & bits) != bits){
+		ESP_LOGW(TAG, "Tasks 0x%x did not stop", bits & ~got);
+		return false;
+	}
+	return true;
+}
+
+// Wake-up timeline. Each phase is recorded once per wake, relative to WAKEUP_BIT.
+void boot_begin(void)
+{
+	memset(boot_phase, 0, sizeof(boot_phase));
+	boot_phase[BOOT_WAKE] = esp_timer_get_time();
+}
+
+void boot_mark(uint8_t phase)
+{
+	if(boot_phase[BOOT_WAKE] == 0 || boot_phase[phase] != 0) return;
+	boot_phase[phase] = esp_timer_get_time();
+	ESP_LOGI(TAG, "Boot: %s at +%u ms", boot_phase_name[phase],
+			(uint32_t)((boot_phase[phase] - boot_phase[BOOT_WAKE]) / 1000));
+}
+
+#if CONFIG_SPECBOX_STRESS_BENCH
+xTaskHandle stress_handle;
+
+// Drives SPP commands alongside whatever is playing and reports deadline misses
+// of the audio, light and dispatcher paths for the configured task placement.
+void stress_task(void *arg)
+{
+	const uint8_t script[] = { COMMAND_MODE_ACTIVE, LIGHT_ON, COMMAND_MODE_ACTIVE, VOLUME_CHANGE, 5 };
+	uint32_t ins = 0, underruns;
+	uint8_t step = 0, i;
+
+	ESP_LOGI(TAG, "Executing: %s", __func__);
+	while(ins != ABORT){
+		cmd_rx(&script[step], 1);
+		step = (step + 1) % sizeof(script);
+
+		underruns = 0;
+		for(i = 0; i < LATENCY_PROFILE_COUNT; i++) underruns += profile_stats[i].underruns;
+		ESP_LOGI(TAG, "Stress [%s]: audio underruns %u, light misses %u/%u, dispatch misses %u/%u (max %u ms)",
+				PLACEMENT_NAME, underruns,
+				deadline_stats.light_misses, deadline_stats.light_frames,
+				deadline_stats.dispatch_misses, deadline_stats.dispatch_msgs, deadline_stats.dispatch_max_us / 1000);
+		ESP_LOGI(TAG, "Stress: %u commands, latency avg %u us max %u us",
+				cmd_stats.commands, cmd_stats.commands ? (uint32_t)(cmd_stats.total_us / cmd_stats.commands) : 0,
+				cmd_stats.max_us);
+		xTaskNotifyWait(0, 0xffffffff, &ins, pdMS_TO_TICKS(CONFIG_SPECBOX_STRESS_PERIOD_MS));
+	}
+	stress_handle = NULL;
+	ESP_LOGI(TAG, "Stopped %s", __func__);
+	task_exit(TASK_STRESS);
+}
+#endif
+
+// Objects are created once in the arena; later cycles only reset them
+static void arena_init(void)
+{
+	uint32_t off = 0;
+	int i;
+
+	for(i = 0; i < TASK_COUNT; i++){
+		stack_offset[i] = off;
+		off += task_table[i].stack;
+	}
+	configASSERT(off <= TASK_STACK_POOL);
+	task_exit_group = xEventGroupCreateStatic(&arena.exit_group);
+	drain_sem = xSemaphoreCreateBinaryStatic(&arena.drain_sem);
+	ring_space = xSemaphoreCreateBinaryStatic(&arena.ring_space);
+	profile_done = xSemaphoreCreateBinaryStatic(&arena.profile_done);
+	cdat_semaphore = xSemaphoreCreateBinaryStatic(&arena.cdat_sem);
+	s_app_task_queue = xQueueCreateStatic(APP_QUEUE_LEN, sizeof(app_msg_t), arena.app_queue, &arena.app_queue_buf);
+	command_stream = xStreamBufferCreateStatic(CMD_STREAM_SIZE, 1, arena.cmd_stream, &arena.cmd_stream_buf);
+	cmd_rx_lock = xSemaphoreCreateMutexStatic(&arena.cmd_rx_lock);
+	cmd_rx_sem = xSemaphoreCreateBinaryStatic(&arena.cmd_rx_sem);
+	audio_channel = xRingbufferCreateStatic(AUDIO_CHANNEL_SIZE, RINGBUF_TYPE_BYTEBUF, arena.ring, &arena.ring_buf);
+	arena_ready = true;
+	ESP_LOGI(TAG, "Arena: %zu bytes, %" PRIu32 " of stacks", sizeof(arena), off);
+}
+
 void app_task_start_up(void)
 {
-	col_data = malloc(CSIZE);
-	audio_data = malloc(CSIZE);
-	cdat_semaphore = xSemaphoreCreateBinary();
-    s_app_task_queue = xQueueCreate(10, sizeof(app_msg_t));
-	command_queue = xQueueCreate(10, 1);
-    xTaskCreate(app_task_handler, "BtAppT", 8192, NULL, configMAX_PRIORITIES - 3, &s_app_task_handle);
+	if(!arena_ready) arena_init();
+	xQueueReset(s_app_task_queue);
+	xStreamBufferReset(command_stream);
+	xSemaphoreTake(cdat_semaphore, 0);
+	xSemaphoreTake(cmd_rx_sem, 0);
+	xSemaphoreTake(drain_sem, 0);
+    start_task(TASK_DISPATCH, NULL, &s_app_task_handle);
     return;
 }
 
 void app_task_shut_down(void)
 {
-    if (s_app_task_handle) { vTaskDelete(s_app_task_handle); s_app_task_handle = NULL; }
-    if (s_app_task_queue) { vQueueDelete(s_app_task_queue); s_app_task_queue = NULL; }
-    if (command_queue) { vQueueDelete(command_queue); command_queue = NULL; }
-    if (cdat_semaphore) { vSemaphoreDelete(cdat_semaphore); cdat_semaphore = NULL;}
-
-    free(col_data);
-    free(audio_data);
+    app_msg_t msg = { .sig = APP_SIG_STOP };
+    if (s_app_task_handle && app_send_msg(&msg)) task_join(TASK_BIT(TASK_DISPATCH), SHUTDOWN_TIMEOUT_MS);
     ESP_LOGI(TAG, "APP Task has been shut down");
 }
 
-static void i2s_task_handler(void *arg)
+static inline size_t ring_cap(void)
 {
-    int i;
-    float V = 0.25;
-    uint32_t VOLUME = 0;
-    uint8_t *data = NULL;
-	size_t item_size = 0;
-	size_t bytes_written = 0;
+	return latency_profiles[latency_profile].ring_bytes;
+}
 
-	while (true) {
-		data = (uint8_t *)xRingbufferReceive(audio_channel, &item_size, 10 / portTICK_PERIOD_MS);
-		xTaskNotifyWait(0, 0, &VOLUME, 0);
-		V = (float)VOLUME / 25.0f;
+static size_t ring_room(void)
+{
+	size_t used = AUDIO_CHANNEL_SIZE - xRingbufferGetCurFreeSize(audio_channel);
+	return used >= ring_cap() ? 0 : ring_cap() - used;
+}
 
-		if (item_size > 0){
-			memset(audio_data, 0, CSIZE);
-			memcpy(audio_data, data, item_size);
-			for(i=0; i<CSIZE; i+=2) {
-			  *((int16_t *)(audio_data+i)) = *((int16_t *)(audio_data+i)) * V;
-			}
-			i2s_write(i2s_out_num, audio_data, item_size, &bytes_written, portMAX_DELAY);
-			vRingbufferReturnItem(audio_channel,(void *)data);
-		}
+// Blocking producers sleep on ring_space, which is given whenever audio leaves
+// the ring or the ring level changes. It is binary, so a give between the check
+// and the take is not lost.
+static void ring_wait_room(size_t size)
+{
+	while(ring_room() < size) xSemaphoreTake(ring_space, portMAX_DELAY);
+}
+
+// The switch runs on the I2S task. Everything else that calls into the I2S
+// driver runs on the dispatcher or waits for it, so the dispatcher waits here
+// while the driver may be reinstalled.
+void request_latency_profile(uint8_t profile)
+{
+	if(profile >= LATENCY_PROFILE_COUNT) return;
+	xSemaphoreTake(profile_done, 0);
+	profile_request = profile;
+	if(s_i2s_task_handle != NULL && xSemaphoreTake(profile_done, pdMS_TO_TICKS(PROFILE_SWITCH_MS)) != pdTRUE){
+		ESP_LOGW(TAG, "Latency profile switch timed out");
 	}
 }
 
-void i2s_task_start_up(void)
+// Runs on the I2S task between blocks. Output is silenced and any audio queued
+// beyond the new ring level is dropped, so the switch never stalls the source.
+static void log_profile_stats(void)
+{
+	profile_stats_t *st = &profile_stats[latency_profile];
+
+	ESP_LOGI(TAG, "Latency profile %s: avg %u ms, %u underruns in %u blocks",
+			latency_profiles[latency_profile].name,
+			st->blocks ? (uint32_t)(st->latency_us / st->blocks / 1000) : 0, st->underruns, st->blocks);
+#if CONFIG_SPECBOX_DSP_CHAIN
+	dsp_chain_log();
+#endif
+}
+
+static esp_err_t i2s_install(void)
 {
-	esp_err_t err;
 	i2s_config_t i2s_config = {
 		.mode = I2S_MODE_MASTER | I2S_MODE_TX,
 		.sample_rate = 44100,
@@ -167,8 +598,8 @@ void i2s_task_start_up(void)
 		.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
 		.communication_format = I2S_COMM_FORMAT_STAND_I2S | I2S_COMM_FORMAT_STAND_MSB,
 		.tx_desc_auto_clear = true,
-		.dma_buf_count = 10,
-		.dma_buf_len = 512,
+		.dma_buf_count = latency_profiles[latency_profile].dma_buf_count,
+		.dma_buf_len = latency_profiles[latency_profile].dma_buf_len,
 		.use_apll = true,
 		.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1 // @suppress("Symbol is not resolved")
 	};
@@ -179,71 +610,620 @@ void i2s_task_start_up(void)
 		.data_out_num = DAC_DIN,
 		.data_in_num = I2S_PIN_NO_CHANGE // @suppress("Symbol is not resolved")
 	};
+	esp_err_t err;
 
+	i2s_dma_bytes = i2s_config.dma_buf_count * i2s_config.dma_buf_len * 4;
 	err = i2s_driver_install(i2s_out_num, &i2s_config, 0, NULL);
 	if(err != ESP_OK){
 		ESP_LOGI(TAG, "I2S Driver install failed");
-		return;
+		return err;
 	}
 	err = i2s_set_pin(i2s_out_num, &pin_config);
-	if(err != ESP_OK){
-		ESP_LOGI(TAG, "I2S pin configuration failed");
-		return;
+	if(err != ESP_OK) ESP_LOGI(TAG, "I2S pin configuration failed");
+	return err;
+}
+
+// A new DMA geometry reinstalls the driver at the current sample rate; the
+// audio still in the DMA chain is lost either way.
+static void apply_latency_profile(void)
+{
+	const latency_profile_t *from = &latency_profiles[latency_profile];
+	float s_rate = i2s_get_clk(i2s_out_num);
+	size_t n;
+	void *p;
+
+	log_profile_stats();
+	latency_profile = profile_request;
+	profile_request = -1;
+
+	if(from->dma_buf_count != latency_profiles[latency_profile].dma_buf_count ||
+			from->dma_buf_len != latency_profiles[latency_profile].dma_buf_len){
+		i2s_driver_uninstall(i2s_out_num);
+		if(i2s_install() != ESP_OK){
+			// back to the geometry that worked
+			latency_profile = from - latency_profiles;
+			i2s_install();
+		}
+		if(s_rate > 0 && s_rate != 44100) i2s_set_clk(i2s_out_num, s_rate, 16, 2);
+	}
+	else i2s_zero_dma_buffer(i2s_out_num);
+	while(ring_room() == 0 && (p = xRingbufferReceiveUpTo(audio_channel, &n, 0, CSIZE)) != NULL){
+		vRingbufferReturnItem(audio_channel, p);
 	}
-    audio_channel = xRingbufferCreate(8192, RINGBUF_TYPE_BYTEBUF);
-    if(audio_channel == NULL){
-    	ESP_LOGE(TAG, "Can't Allocate required channel.");
-        return;
+	xSemaphoreGive(ring_space);
+	xSemaphoreGive(profile_done);
+	ESP_LOGI(TAG, "Switched to %s latency profile", latency_profiles[latency_profile].name);
+}
+
+static void drift_reset(void)
+{
+	drift_pos = 0.0f;
+	drift_integ = 0.0f;
+	drift_step = 1.0f;
+	drift_avg = DRIFT_TARGET_FILL;
+	drift_prev[0] = drift_prev[1] = 0;
+	drift_ppm = 0;
+}
+
+// PI loop on the smoothed ring fill: a filling ring means the source clock is
+// ahead of the I2S clock, so input is consumed slightly faster and vice versa.
+static void drift_update(void)
+{
+	const float max_adj = CONFIG_SPECBOX_DRIFT_MAX_PPM * 1e-6f;
+	float e, adj;
+	size_t fill = AUDIO_CHANNEL_SIZE - xRingbufferGetCurFreeSize(audio_channel);
+
+	drift_avg += DRIFT_FILL_ALPHA * ((float)fill - drift_avg);
+	e = (drift_avg - DRIFT_TARGET_FILL) / ring_cap();
+	drift_integ += e;
+	if(drift_integ * DRIFT_KI > max_adj) drift_integ = max_adj / DRIFT_KI;
+	else if(drift_integ * DRIFT_KI < -max_adj) drift_integ = -max_adj / DRIFT_KI;
+
+	adj = DRIFT_KP * e + DRIFT_KI * drift_integ;
+	if(adj > max_adj) adj = max_adj;
+	else if(adj < -max_adj) adj = -max_adj;
+	drift_step = 1.0f + adj;
+
+	drift_fill = (uint8_t)(drift_avg * 100 / ring_cap());
+	drift_ppm = (int32_t)(adj * 1e6f);
+}
+
+// Linear interpolation of interleaved stereo frames at drift_step input frames
+// per output frame. Returns the number of output frames.
+static size_t drift_resample(const int16_t *in, size_t frames, int16_t *out)
+{
+	size_t n = 0, i;
+	float pos = drift_pos, frac;
+	const int16_t *a, *b;
+
+	while((i = (size_t)pos) < frames){
+		frac = pos - i;
+		a = i == 0 ? drift_prev : in + 2 * (i - 1);
+		b = in + 2 * i;
+		out[2*n] = a[0] + (b[0] - a[0]) * frac;
+		out[2*n+1] = a[1] + (b[1] - a[1]) * frac;
+		n += 1;
+		pos += drift_step;
+	}
+	drift_pos = pos - frames;
+	drift_prev[0] = in[2 * (frames - 1)];
+	drift_prev[1] = in[2 * (frames - 1) + 1];
+	return n;
+}
+
+static void env_reset(float rate)
+{
+	env_rate = rate;
+	env_atk = 1000.0f / (CONFIG_SPECBOX_ENV_ATTACK_MS * rate);
+	env_rel = 1000.0f / (CONFIG_SPECBOX_ENV_RELEASE_MS * rate);
+	env_ms[0] = env_ms[1] = 0.0f;
+	env_pk[0] = env_pk[1] = 0.0f;
+	env_head = env_count = 0;
+	env_level[0] = env_level[1] = 0;
+}
+
+// One-pole step over a whole block of the given mean square
+static float env_follow(float e, float ms, float frames)
+{
+	e += (ms - e) * (1.0f - expf(-frames * (ms > e ? env_atk : env_rel)));
+	// below one LSB is silence; keeps the release out of denormals
+	return e < 1.0f ? 0.0f : e;
+}
+
+// Peak step: a louder block peak is taken as it is, a softer one released to
+static float env_peak(float e, float pk, float frames)
+{
+	return pk >= e ? pk : env_follow(e, pk, frames);
+}
+
+// Envelope step for a block of the given per-channel sums of squares and
+// largest squares
+static void env_block(const float *sq, size_t frames)
+{
+	if(frames == 0) return;
+	env_ms[0] = env_follow(env_ms[0], sq[0] / frames, frames);
+	env_ms[1] = env_follow(env_ms[1], sq[1] / frames, frames);
+	env_pk[0] = env_peak(env_pk[0], sq[2], frames);
+	env_pk[1] = env_peak(env_pk[1], sq[3], frames);
+}
+
+#if !CONFIG_SPECBOX_DSP_CHAIN || CONFIG_SPECBOX_ENVELOPE_BENCH
+// Gain and envelope in one pass, so each sample is loaded and stored once and
+// costs one extra multiply-add and compare. n counts samples, L and R
+// interleaved.
+static void gain_envelope(int16_t *s, size_t n, float V)
+{
+	float l, r, q, sq[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	size_t i;
+
+	for(i = 0; i + 1 < n; i += 2){
+		l = s[i] * V;
+		r = s[i+1] * V;
+		s[i] = l;
+		s[i+1] = r;
+		q = l * l;
+		sq[0] += q;
+		if(q > sq[2]) sq[2] = q;
+		q = r * r;
+		sq[1] += q;
+		if(q > sq[3]) sq[3] = q;
+	}
+	if(i < n) s[i] = s[i] * V;
+	env_block(sq, i / 2);
+}
+#endif
+
+// No audio for ms: release as over a silent block
+static void env_idle(uint32_t ms)
+{
+	env_ms[0] = env_follow(env_ms[0], 0.0f, env_rate * ms / 1000.0f);
+	env_ms[1] = env_follow(env_ms[1], 0.0f, env_rate * ms / 1000.0f);
+	env_pk[0] = env_follow(env_pk[0], 0.0f, env_rate * ms / 1000.0f);
+	env_pk[1] = env_follow(env_pk[1], 0.0f, env_rate * ms / 1000.0f);
+}
+
+// dB below full scale, ENV_FLOOR_DB..0 onto 0..255
+static uint8_t env_to_level(float ms)
+{
+	float db;
+
+	if(ms <= 0.0f) return 0;
+	db = 10.0f * log10f(ms * (1.0f / (32768.0f * 32768.0f)));
+	if(db <= ENV_FLOOR_DB) return 0;
+	if(db >= 0.0f) return 255;
+	return (uint8_t)((db - ENV_FLOOR_DB) * (255.0f / -ENV_FLOOR_DB));
+}
+
+static void env_push(int64_t due)
+{
+	env_point_t *p;
+
+	if(env_count == ENV_QUEUE_LEN){
+		env_head = (env_head + 1) % ENV_QUEUE_LEN;
+		env_count -= 1;
+	}
+	p = &env_queue[(env_head + env_count) % ENV_QUEUE_LEN];
+	env_count += 1;
+	p->due = due;
+	p->level[0] = env_to_level(fmaxf(env_ms[0], ENV_PEAK_WEIGHT * env_pk[0]));
+	p->level[1] = env_to_level(fmaxf(env_ms[1], ENV_PEAK_WEIGHT * env_pk[1]));
+}
+
+// Publishes the levels whose audio is playing now and, with the lights on,
+// puts them on the neons: these follow the music at the block rate.
+static void env_show(int64_t now)
+{
+#if CONFIG_SPECBOX_NEON_ENVELOPE
+	bool live = LGT != LIGHT_OFF && !OVL_STATE;
+	uint8_t br = gov.brightness;
+#endif
+
+	while(env_count > 0 && env_queue[env_head].due <= now){
+		env_level[0] = env_queue[env_head].level[0];
+		env_level[1] = env_queue[env_head].level[1];
+		env_head = (env_head + 1) % ENV_QUEUE_LEN;
+		env_count -= 1;
+	}
+#if CONFIG_SPECBOX_NEON_ENVELOPE
+	if(live){
+		dac_output_voltage(NEON_1, (NEON_FLOOR + env_level[0] * (255 - NEON_FLOOR) / 255) * br / 255);
+		dac_output_voltage(NEON_2, (NEON_FLOOR + env_level[1] * (255 - NEON_FLOOR) / 255) * br / 255);
+	}
+	else if(neon_live){
+		dac_output_voltage(NEON_1, 0);
+		dac_output_voltage(NEON_2, 0);
+	}
+	neon_live = live;
+#endif
+}
+
+#if CONFIG_SPECBOX_ENVELOPE_BENCH
+static volatile float bench_gain = 1.0f;
+
+// The gain loop as it was before the envelope, against the fused pass
+static void envelope_bench(void)
+{
+	int16_t *s = (int16_t *)audio_data;
+	float V = bench_gain;
+	uint32_t seed = 1, i, k;
+	int64_t t0, t_gain, t_fused;
+
+	for(i = 0; i < CSIZE / 2; i++){
+		seed = seed * 1664525 + 1013904223;
+		s[i] = seed >> 16;
+	}
+	t0 = esp_timer_get_time();
+	for(k = 0; k < ENV_BENCH_BLOCKS; k++){
+		for(i = 0; i < CSIZE; i += 2){
+			*((int16_t *)(audio_data + i)) = *((int16_t *)(audio_data + i)) * V;
+		}
+	}
+	t_gain = esp_timer_get_time() - t0;
+	t0 = esp_timer_get_time();
+	for(k = 0; k < ENV_BENCH_BLOCKS; k++) gain_envelope(s, CSIZE / 2, V);
+	t_fused = esp_timer_get_time() - t0;
+	ESP_LOGI(TAG, "Envelope bench: gain %u ns/block, gain+envelope %u ns/block (%+d%%)",
+			(uint32_t)(t_gain * 1000 / ENV_BENCH_BLOCKS), (uint32_t)(t_fused * 1000 / ENV_BENCH_BLOCKS),
+			t_gain ? (int)((t_fused - t_gain) * 100 / t_gain) : 0);
+}
+#endif
+
+static void i2s_task_handler(void *arg)
+{
+    float V = 0.25;
+    uint32_t VOLUME = 0;
+    uint8_t *data = NULL;
+	size_t item_size = 0;
+	size_t out_size = 0;
+	size_t bytes_written = 0;
+	uint16_t drift_log = 0;
+	int64_t now, last_write = 0;
+	int64_t dma_us;
+	float s_rate;
+	profile_stats_t *st;
+#if CONFIG_SPECBOX_DSP_CHAIN
+	float sq[4];
+#endif
+
+#if CONFIG_SPECBOX_ENVELOPE_BENCH
+	envelope_bench();
+#endif
+	drift_reset();
+	env_reset(i2s_get_clk(i2s_out_num));
+#if CONFIG_SPECBOX_DSP_CHAIN
+	dsp_chain_rate(env_rate);
+#endif
+	while (true) {
+		if(profile_request >= 0) apply_latency_profile();
+		data = (uint8_t *)xRingbufferReceiveUpTo(audio_channel, &item_size,
+				latency_profiles[latency_profile].rx_timeout_ms / portTICK_PERIOD_MS, CSIZE);
+		// stop only once the ring has played out and no item is held
+		if(data == NULL && i2s_stopping) break;
+		xTaskNotifyWait(0, 0, &VOLUME, 0);
+		V = (float)VOLUME / 25.0f;
+		s_rate = i2s_get_clk(i2s_out_num);
+		if(s_rate != env_rate){
+			env_reset(s_rate);
+#if CONFIG_SPECBOX_DSP_CHAIN
+			dsp_chain_rate(s_rate);
+#endif
+		}
+		dma_us = (int64_t)(i2s_dma_bytes * 250000.0f / s_rate);
+
+		if (data != NULL && item_size > 0){
+			if(MODE == BLUETOOTH_MODE && item_size % 4 == 0){
+				drift_update();
+				out_size = 4 * drift_resample((const int16_t *)data, item_size / 4, (int16_t *)audio_data);
+				if(++drift_log == 512){
+					drift_log = 0;
+					ESP_LOGI(TAG, "Drift: fill %u%%, ratio %+d ppm, dropped %u, stretched %u",
+							drift_fill, drift_ppm, ingress_stats.dropped, ingress_stats.stretched);
+				}
+			}else{
+				if(drift_step != 1.0f || drift_pos != 0.0f) drift_reset();
+				memcpy(audio_data, data, item_size);
+				out_size = item_size;
+			}
+			i2s_pending = out_size;
+			vRingbufferReturnItem(audio_channel,(void *)data);
+			xSemaphoreGive(ring_space);
+#if CONFIG_SPECBOX_DSP_CHAIN
+			// volume is one of the chain's stages
+			chain_volume = V;
+			dsp_chain_process((int16_t *)audio_data, out_size / 2, sq);
+			env_block(sq, out_size / 4);
+#else
+			gain_envelope((int16_t *)audio_data, out_size / 2, V);
+#endif
+
+			// the DMA chain ran dry if this block comes later than the audio queued
+			// behind the previous one; long gaps are pauses, not underruns
+			st = &profile_stats[latency_profile];
+			now = esp_timer_get_time();
+			if(last_write && now - last_write > dma_us &&
+					now - last_write < UNDERRUN_WINDOW_US){
+				st->underruns += 1;
+			}
+			st->blocks += 1;
+			st->latency_us += pipeline_latency_us();
+			if(st->blocks % 2048 == 0) log_profile_stats();
+
+			i2s_write(i2s_out_num, audio_data, out_size, &bytes_written, portMAX_DELAY);
+			i2s_pending = 0;
+			last_write = esp_timer_get_time();
+			// the chain is full again: the end of this block plays dma_us from now
+			env_push(last_write + dma_us);
+			boot_mark(BOOT_FIRST_AUDIO);
+		}
+		else if(data == NULL){
+			env_idle(latency_profiles[latency_profile].rx_timeout_ms);
+			env_push(esp_timer_get_time() + dma_us);
+		}
+		env_show(esp_timer_get_time());
+	}
+	s_i2s_task_handle = NULL;
+	task_exit(TASK_I2S);
+}
+
+void i2s_task_start_up(void)
+{
+	size_t n;
+	void *p;
+
+	if(i2s_held){
+		if(!slot_wait(TASK_I2S)) return;
+		i2s_driver_uninstall(i2s_out_num);
+		i2s_held = false;
+	}
+	if(i2s_install() != ESP_OK) return;
+    // whatever a timed-out stop left behind
+    while((p = xRingbufferReceiveUpTo(audio_channel, &n, 0, AUDIO_CHANNEL_SIZE)) != NULL){
+    	vRingbufferReturnItem(audio_channel, p);
     }
+    xSemaphoreGive(ring_space);
 
-    xTaskCreate(i2s_task_handler, "BtI2ST", 6144, NULL, tskIDLE_PRIORITY, &s_i2s_task_handle);
+#if CONFIG_SPECBOX_DSP_CHAIN
+    // stages registered on the first wake, kept after
+    dsp_chain_init(&chain_volume);
+#endif
+    i2s_stopping = false;
+    start_task(TASK_I2S, NULL, &s_i2s_task_handle);
     return;
 }
 
+#if CONFIG_SPECBOX_SOAK_CYCLES > 0
+// Runs wake/sleep cycles without audio or servos and tracks what they leave in
+// the heap: free size and the largest block the Bluetooth stack could still get.
+void soak_run(uint32_t cycles)
+{
+	size_t free0 = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	size_t big0 = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+	size_t big, big_min = big0;
+	uint32_t i;
+
+	ESP_LOGI(TAG, "Soak: %u cycles, free %u, largest block %u", cycles, free0, big0);
+	for(i = 1; i <= cycles; i++){
+		app_task_start_up();
+		i2s_task_start_up();
+		app_work_dispatch(cmpl_tasks_start_up, 0, NULL, 0);
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_SPECBOX_SOAK_AWAKE_MS));
+		app_work_dispatch(cmpl_tasks_shut_down, 0, NULL, 0);
+		app_work_drain(SHUTDOWN_TIMEOUT_MS);
+		cmpl_tasks_join(SHUTDOWN_TIMEOUT_MS);
+		i2s_task_shut_down();
+		app_task_shut_down();
+
+		big = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+		if(big < big_min) big_min = big;
+		if(i % 100 == 0 || i == cycles){
+			ESP_LOGI(TAG, "Soak %u: free %d, largest block %d (min %u), low water %u", i,
+					(int)heap_caps_get_free_size(MALLOC_CAP_8BIT) - (int)free0, (int)big - (int)big0,
+					big_min, heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+		}
+	}
+}
+#endif
+
 void cmpl_tasks_start_up(uint16_t event, void *param){
-	xTaskCreate(process_colors, "color_task", 20480, col_data, tskIDLE_PRIORITY, &color_handle);
-	xTaskCreate(sensor_task, "sensor_task", 2048, NULL, 3, &sensor_handle);
-	xTaskCreate(cmd_cb_task, "cmd_task", 3072, NULL, 1, &command_handle);
-	xTaskCreate(play_default, "default_task", 8192, NULL, 5, &def_handle);
+	cmpl_bits = TASK_BIT(TASK_COLOR) | TASK_BIT(TASK_SENSOR) | TASK_BIT(TASK_CMD) | TASK_BIT(TASK_DEFAULT);
+#if CONFIG_SPECBOX_STRESS_BENCH
+	cmpl_bits |= TASK_BIT(TASK_STRESS);
+#endif
+	// a task that did not start is not joined
+	if(!start_task(TASK_COLOR, col_data, &color_handle)) cmpl_bits &= ~TASK_BIT(TASK_COLOR);
+	if(!start_task(TASK_SENSOR, NULL, &sensor_handle)) cmpl_bits &= ~TASK_BIT(TASK_SENSOR);
+	if(!start_task(TASK_CMD, NULL, &command_handle)) cmpl_bits &= ~TASK_BIT(TASK_CMD);
+	if(!start_task(TASK_DEFAULT, NULL, &def_handle)) cmpl_bits &= ~TASK_BIT(TASK_DEFAULT);
+#if CONFIG_SPECBOX_STRESS_BENCH
+	if(!start_task(TASK_STRESS, NULL, &stress_handle)) cmpl_bits &= ~TASK_BIT(TASK_STRESS);
+#endif
+}
+
+bool cmpl_tasks_join(uint32_t timeout_ms)
+{
+	bool ok = cmpl_bits == 0 || task_join(cmpl_bits, timeout_ms);
+	cmpl_bits = 0;
+	return ok;
 }
 
 void cmpl_tasks_shut_down(uint16_t event, void *param){
 	if(def_handle != NULL) {xTaskNotify(def_handle, ABORT, eSetValueWithOverwrite);}
 	if(color_handle != NULL) {xTaskNotify(color_handle, ABORT, eSetValueWithOverwrite);}
-	if(command_handle != NULL) {xTaskNotify(command_handle, ABORT, eSetValueWithOverwrite);}
+	if(command_handle != NULL) {cmd_task_abort();}
 	if(sensor_handle != NULL) {xTaskNotify(sensor_handle, ABORT, eSetValueWithOverwrite);}
+#if CONFIG_SPECBOX_STRESS_BENCH
+	if(stress_handle != NULL) {xTaskNotify(stress_handle, ABORT, eSetValueWithOverwrite);}
+#endif
 }
 
 void i2s_task_shut_down(void)
 {
     if (s_i2s_task_handle) {
-        vTaskDelete(s_i2s_task_handle);
-        s_i2s_task_handle = NULL;
+        i2s_stopping = true;
+        if(!task_join(TASK_BIT(TASK_I2S), SHUTDOWN_TIMEOUT_MS)){
+        	// still writing: the driver stays until the next wake finds the slot free
+        	i2s_held = true;
+        	ESP_LOGW(TAG, "I2S driver left installed");
+        	return;
+        }
+        // let the DMA chain play out before the driver goes
+        vTaskDelay(pdMS_TO_TICKS(i2s_dma_bytes * 250 / i2s_get_clk(i2s_out_num)) + 1);
     }
 
-    if (audio_channel) {
-        vRingbufferDelete(audio_channel);
-        audio_channel = NULL;
-    }
 
     i2s_driver_uninstall(i2s_out_num);
     ESP_LOGI(TAG, "I2S Task has been shut down");
 }
 
 
-void write_ringbuf(const uint8_t *data, size_t size)
+uint32_t pipeline_latency_us(void)
 {
-	if(STL_STATE || OVL_STATE) return;
+	// audio queued ahead of a block entering the ring: ring fill, the block held
+	// by the I2S task and the DMA chain, which stays full while streaming
+	size_t queued = i2s_dma_bytes + i2s_pending;
+	float s_rate = i2s_get_clk(i2s_out_num);
+
+	if(audio_channel) queued += AUDIO_CHANNEL_SIZE - xRingbufferGetCurFreeSize(audio_channel);
+	if(s_rate <= 0) s_rate = 44100;
+	return (uint32_t)((float)queued * 250000.0f / s_rate);
+}
 
+static void set_col_due(int64_t due)
+{
+	portENTER_CRITICAL(&col_due_lock);
+	col_due = due;
+	portEXIT_CRITICAL(&col_due_lock);
+}
+
+int64_t get_col_due(void)
+{
+	int64_t due;
+
+	portENTER_CRITICAL(&col_due_lock);
+	due = col_due;
+	portEXIT_CRITICAL(&col_due_lock);
+	return due;
+}
+
+static void tap_col_data(const uint8_t *data, size_t size)
+{
 	if(size < CSIZE){
 		memcpy(col_data, data, size);
 		memset(col_data + size, 0, CSIZE - size);
 	}else{
 		memcpy(col_data, data, CSIZE);
 	}
+	TRK_STATE = false;
+	set_col_due(esp_timer_get_time() + pipeline_latency_us());
+#if CONFIG_SPECBOX_TRACE
+	trc_audio_t a = { ++col_seq, size, ring_room() };
+#if CONFIG_SPECBOX_TRACE_PCM
+	trace_put2(TRC_AUDIO, TRC_SRC_PCM, &a, sizeof(a), col_data, CSIZE);
+#else
+	trace_put(TRC_AUDIO, TRC_SRC_PCM, &a, sizeof(a));
+#endif
+#endif
 	xSemaphoreGive(cdat_semaphore);
+}
+
+void write_ringbuf(const uint8_t *data, size_t size)
+{
+	if(STL_STATE || OVL_STATE) return;
+
+	tap_col_data(data, size);
+	ring_wait_room(size);
 	xRingbufferSend(audio_channel, (void *)data, size, (portTickType)portMAX_DELAY);
 }
 
+// Prompts skip the light tap but stay under the profile's ring level. One call
+// takes at most ring_cap() bytes.
+bool write_ringbuf_narrate(const uint8_t *data, size_t size)
+{
+	if(size > ring_cap()) return false;
+	ring_wait_room(size);
+	return xRingbufferSend(audio_channel, (void *)data, size, (portTickType)portMAX_DELAY) == pdTRUE;
+}
 
+#if CONFIG_SPECBOX_OVERFLOW_DROP_OLDEST
+// Discards audio from the head of the ring until `size` bytes fit. The I2S task
+// returns its item before writing to the DAC, so the ring is rarely held.
+static bool ingress_make_room(size_t size)
+{
+	size_t free_size, n;
+	void *p;
+	while((free_size = ring_room()) < size){
+		p = xRingbufferReceiveUpTo(audio_channel, &n, 0, size - free_size);
+		if(p == NULL) return false;
+		vRingbufferReturnItem(audio_channel, p);
+		ingress_stats.dropped_bytes += n;
+	}
+	return true;
+}
+#elif CONFIG_SPECBOX_OVERFLOW_TIME_STRETCH
+static int16_t stretch_data[CSIZE / 2];
+
+// Squeezes the block into the space left in the ring. Limited to 25% so the
+// pitch blip of a single stretched block stays inaudible.
+static bool ingress_stretch(const uint8_t *data, size_t size)
+{
+	const int16_t *in = (const int16_t *)data;
+	size_t frames = size / 4, out_frames, i, k;
+	float step;
 
+	out_frames = ring_room() / 4;
+	if(size > CSIZE || size % 4 != 0 || out_frames < frames * 3 / 4 || out_frames < 2) return false;
+	step = (float)(frames - 1) / (out_frames - 1);
+	for(i = 0; i < out_frames; i++){
+		k = (size_t)(i * step);
+		if(k >= frames - 1) k = frames - 2;
+		stretch_data[2*i] = in[2*k] + (in[2*k+2] - in[2*k]) * (i * step - k);
+		stretch_data[2*i+1] = in[2*k+1] + (in[2*k+3] - in[2*k+1]) * (i * step - k);
+	}
+	return xRingbufferSend(audio_channel, stretch_data, out_frames * 4, 0) == pdTRUE;
+}
+#endif
+
+// Bluetooth ingress: never blocks the A2DP data callback. When the ring is full
+// the configured overflow policy decides what is lost.
+void write_ringbuf_nb(const uint8_t *data, size_t size)
+{
+	if(STL_STATE || OVL_STATE) return;
+
+	tap_col_data(data, size);
+	if(ring_room() >= size &&
+			xRingbufferSend(audio_channel, (void *)data, size, CONFIG_SPECBOX_INGRESS_TIMEOUT_MS / portTICK_PERIOD_MS) == pdTRUE){
+		ingress_stats.sent += 1;
+		return;
+	}
+#if CONFIG_SPECBOX_OVERFLOW_DROP_OLDEST
+	if(ingress_make_room(size) && xRingbufferSend(audio_channel, (void *)data, size, 0) == pdTRUE){
+		ingress_stats.sent += 1;
+		ingress_stats.dropped += 1;
+		return;
+	}
+#elif CONFIG_SPECBOX_OVERFLOW_TIME_STRETCH
+	if(ingress_stretch(data, size)){
+		ingress_stats.sent += 1;
+		ingress_stats.stretched += 1;
+		return;
+	}
+#endif
+	ingress_stats.dropped += 1;
+	ingress_stats.dropped_bytes += size;
+}
+
+void write_ringbuf_track(const uint8_t *data, size_t size, const uint8_t *bands)
+{
+	if(STL_STATE || OVL_STATE) return;
+
+	memcpy(col_track, bands, HN_LED);
+	TRK_STATE = true;
+	set_col_due(esp_timer_get_time() + pipeline_latency_us());
+#if CONFIG_SPECBOX_TRACE
+	trc_audio_t a = { ++col_seq, size, ring_room() };
+	trace_put2(TRC_AUDIO, TRC_SRC_TRACK, &a, sizeof(a), bands, HN_LED);
+#endif
+	xSemaphoreGive(cdat_semaphore);
+	ring_wait_room(size);
+	xRingbufferSend(audio_channel, (void *)data, size, (portTickType)portMAX_DELAY);
+}
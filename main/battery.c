@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "driver/adc.h"
+#include "esp_log.h"
+
+#define TAG "BATTERY"
+
+// Battery and charger inputs, read in short oversampled bursts. ADC continuous
+// mode needs I2S0, which drives the DAC, and cannot reach ADC2 anyway, so each
+// burst is a run of one-shot reads reduced by a median, then smoothed by an EMA.
+// Level changes need to clear a hysteresis band, and a critical level must hold
+// for BAT_CRIT_CONFIRM bursts before it is reported.
+#define BAT_BURST					15
+#define BAT_MIN_VALID				8
+#define BAT_EMA_ALPHA				0.3f
+#define BAT_HYST					8
+#define BAT_CRIT_CONFIRM			2
+#define BAT_LOW_REPEAT				6
+
+#define CRG_ON_BOUND				288
+#define CRG_OFF_BOUND				224
+
+uint8_t battery_soc = BATTERY_SOC_UNKNOWN;
+int battery_raw = 0;
+
+static float volt_ema;
+static bool volt_valid;
+static bool charging;
+static uint8_t level;
+static uint8_t crit_count, low_repeat;
+static uint32_t adc2_busy;
+
+#define LEVEL_NORMAL				0
+#define LEVEL_LOW					1
+#define LEVEL_CRITICAL				2
+
+static int median(int *v, int n)
+{
+	int i, j, t;
+
+	for(i = 1; i < n; i++){
+		t = v[i];
+		for(j = i; j > 0 && v[j - 1] > t; j--) v[j] = v[j - 1];
+		v[j] = t;
+	}
+	return v[n / 2];
+}
+
+static int read_charger(void)
+{
+	int v[BAT_BURST], i;
+
+	for(i = 0; i < BAT_BURST; i++) v[i] = adc1_get_raw(CHARGER_DETECT);
+	return median(v, BAT_BURST);
+}
+
+// ADC2 reads fail while the radio holds the converter; those are skipped
+static bool read_voltage(int *raw)
+{
+	int v[BAT_BURST], n = 0, i, r;
+
+	for(i = 0; i < BAT_BURST; i++){
+		if(adc2_get_raw(VOLTAGE_SENSOR, ADC_WIDTH_BIT_10, &r) == ESP_OK) v[n++] = r;
+		else adc2_busy += 1;
+	}
+	if(n < BAT_MIN_VALID) return false;
+	*raw = median(v, n);
+	return true;
+}
+
+static uint8_t estimate_soc(float raw)
+{
+	float s = (raw - CRITICAL_CHARGE_BOUND) * 100.0f / (FULL_CHARGE_BOUND - CRITICAL_CHARGE_BOUND);
+	return s <= 0.0f ? 0 : s >= 100.0f ? 100 : (uint8_t)s;
+}
+
+void battery_init(void)
+{
+	adc2_config_channel_atten(VOLTAGE_SENSOR, ADC_ATTEN_DB_11);
+	adc1_config_channel_atten(CHARGER_DETECT, ADC_ATTEN_DB_6);
+	adc1_config_width(ADC_WIDTH_BIT_9);
+	volt_valid = false;
+	charging = false;
+	level = LEVEL_NORMAL;
+	crit_count = 0;
+	low_repeat = 0;
+	battery_soc = BATTERY_SOC_UNKNOWN;
+}
+
+uint8_t battery_update(void)
+{
+	uint8_t ev = 0, soc;
+	int c = read_charger(), raw;
+
+	if(!charging && c > CRG_ON_BOUND){
+		charging = true;
+		level = LEVEL_NORMAL;
+		crit_count = 0;
+		ev |= BAT_EVT_CRG_CONN;
+	}
+	else if(charging && c < CRG_OFF_BOUND){
+		charging = false;
+		volt_valid = false;
+		ev |= BAT_EVT_CRG_DISCONN;
+	}
+
+	if(!read_voltage(&raw)) return ev;
+	volt_ema = volt_valid ? volt_ema + BAT_EMA_ALPHA * (raw - volt_ema) : raw;
+	volt_valid = true;
+	battery_raw = (int)volt_ema;
+
+	// the charger lifts the reading, so the estimate only moves down on battery
+	soc = estimate_soc(volt_ema);
+	if(charging || battery_soc == BATTERY_SOC_UNKNOWN || soc < battery_soc){
+		if(soc != battery_soc) ESP_LOGI(TAG, "State of charge %u%%", soc);
+		battery_soc = soc;
+	}
+	if(charging) return ev;
+
+	if(volt_ema <= CRITICAL_CHARGE_BOUND){
+		if(++crit_count >= BAT_CRIT_CONFIRM && level != LEVEL_CRITICAL){
+			level = LEVEL_CRITICAL;
+			ev |= BAT_EVT_CRITICAL;
+		}
+	}
+	else{
+		crit_count = 0;
+		if(level == LEVEL_CRITICAL && volt_ema > CRITICAL_CHARGE_BOUND + BAT_HYST) level = LEVEL_LOW;
+		if(level == LEVEL_NORMAL && volt_ema <= LOW_CHARGE_BOUND){
+			level = LEVEL_LOW;
+			low_repeat = 0;
+		}
+		else if(level == LEVEL_LOW && volt_ema > LOW_CHARGE_BOUND + BAT_HYST) level = LEVEL_NORMAL;
+	}
+	if(level == LEVEL_LOW){
+		if(low_repeat == 0){
+			ev |= BAT_EVT_LOW;
+			low_repeat = BAT_LOW_REPEAT;
+		}
+		else low_repeat -= 1;
+	}
+	ESP_LOGD(TAG, "raw %d ema %d soc %u%% charger %d adc2 busy %u", raw, battery_raw, battery_soc, c, adc2_busy);
+	return ev;
+}
@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+
+// Onset and tempo from the analyzer's spectrum, one update per block.
+//   onset: spectral flux, the rise of log band energy summed over the bands,
+//          peak-picked against a running mean + deviation
+//   tempo: autocorrelation of the zero-mean flux over the lags of BEAT_MIN_BPM
+//          to BEAT_MAX_BPM, leaky so it follows tempo changes, weighted
+//          towards BEAT_PRIOR_BPM against octave errors
+//   phase: advanced by one block each update, pulled towards onsets near the
+//          predicted beat
+// Per block that is one log2f per band plus BEAT_LAGS multiply-adds, against
+// the FFT and band sums it reuses.
+#define BEAT_FPS					(44100.0f / CHUNK_SIZE)
+#define BEAT_MIN_BPM				60
+#define BEAT_MAX_BPM				200
+#define BEAT_PRIOR_BPM				120
+#define BEAT_LAG_MIN				(44100 * 60 / (CHUNK_SIZE * BEAT_MAX_BPM))
+#define BEAT_LAG_MAX				(44100 * 60 / (CHUNK_SIZE * BEAT_MIN_BPM) + 1)
+#define BEAT_LAGS					(BEAT_LAG_MAX - BEAT_LAG_MIN + 1)
+#define BEAT_HIST					64				// power of two, > BEAT_LAG_MAX
+#define BEAT_AC_DECAY				0.997f			// ~8 s
+#define BEAT_MEAN_RATE				0.02f
+#define BEAT_THRESHOLD				1.5f			// deviations above the mean
+#define BEAT_PLL					0.2f
+#define BEAT_WINDOW					0.25f			// of a period, around the beat
+
+#if BEAT_HIST <= BEAT_LAG_MAX
+#error "flux history shorter than the longest lag"
+#endif
+
+beat_t beat;
+
+static float prev[BEAT_MAX_BANDS];
+static uint8_t prev_bands;
+static float hist[BEAT_HIST];
+static uint8_t hist_pos;
+static float ac[BEAT_LAGS], ac0;
+static float prior[BEAT_LAGS];
+static float mean, var;
+static float odf_1, odf_2;
+static float period;
+
+void beat_reset(void)
+{
+	int i;
+	float o;
+
+	memset(&beat, 0, sizeof(beat));
+	memset(hist, 0, sizeof(hist));
+	memset(ac, 0, sizeof(ac));
+	hist_pos = 0;
+	prev_bands = 0;
+	ac0 = mean = var = odf_1 = odf_2 = 0.0f;
+	period = BEAT_FPS * 60 / BEAT_PRIOR_BPM;
+	for(i = 0; i < BEAT_LAGS; i++){
+		// log-normal around the prior, an octave wide
+		o = log2f((BEAT_LAG_MIN + i) / period);
+		prior[i] = expf(-0.5f * o * o);
+	}
+	beat.bpm = BEAT_PRIOR_BPM;
+}
+
+static void advance(void)
+{
+	beat.beat = false;
+	beat.phase += 1.0f / period;
+	if(beat.phase >= 1.0f){
+		beat.phase -= 1.0f;
+		beat.beat = true;
+		beat.count += 1;
+	}
+	// a short flash from each beat, as strong as the tempo is clear
+	beat.pulse = beat.confidence * (1.0f - beat.phase) * (1.0f - beat.phase) * (1.0f - beat.phase);
+}
+
+static void tempo(void)
+{
+	int i, best = 0;
+	float s, best_s = 0.0f, a, b, c, d, lag;
+
+	for(i = 0; i < BEAT_LAGS; i++){
+		s = ac[i] * prior[i];
+		if(s > best_s){
+			best_s = s;
+			best = i;
+		}
+	}
+	if(best_s <= 0.0f || ac0 <= 0.0f) return;
+	lag = BEAT_LAG_MIN + best;
+	if(best > 0 && best < BEAT_LAGS - 1){
+		// parabola through the peak and its neighbours
+		a = ac[best - 1];
+		b = ac[best];
+		c = ac[best + 1];
+		d = a - 2.0f * b + c;
+		if(d < 0.0f) lag += 0.5f * (a - c) / d;
+	}
+	period += 0.1f * (lag - period);
+	beat.bpm = BEAT_FPS * 60 / period;
+	beat.confidence = ac[best] / ac0;
+	if(beat.confidence > 1.0f) beat.confidence = 1.0f;
+	if(beat.confidence < 0.0f) beat.confidence = 0.0f;
+}
+
+static void flux(float odf)
+{
+	float x, dev, err;
+	int i;
+
+	// peak at the previous block: above both neighbours and the threshold
+	dev = sqrtf(var);
+	beat.onset = odf_1 > odf_2 && odf_1 >= odf && odf_1 > mean + BEAT_THRESHOLD * dev;
+	beat.strength = beat.onset && dev > 0.0f ? (odf_1 - mean) / dev : 0.0f;
+	odf_2 = odf_1;
+	odf_1 = odf;
+
+	x = odf - mean;
+	mean += BEAT_MEAN_RATE * x;
+	var += BEAT_MEAN_RATE * (x * x - var);
+
+	hist_pos = (hist_pos + 1) & (BEAT_HIST - 1);
+	hist[hist_pos] = x;
+	ac0 = ac0 * BEAT_AC_DECAY + x * x;
+	for(i = 0; i < BEAT_LAGS; i++){
+		ac[i] = ac[i] * BEAT_AC_DECAY + x * hist[(hist_pos - BEAT_LAG_MIN - i) & (BEAT_HIST - 1)];
+	}
+	tempo();
+	advance();
+
+	if(beat.onset){
+		// the onset was a block ago
+		err = beat.phase - 1.0f / period;
+		if(err >= 0.5f) err -= 1.0f;
+		if(err < -0.5f) err += 1.0f;
+		if(fabsf(err) < BEAT_WINDOW) beat.phase -= BEAT_PLL * err;
+		if(beat.phase < 0.0f) beat.phase += 1.0f;
+		if(beat.phase >= 1.0f) beat.phase -= 1.0f;
+	}
+}
+
+// Band energies, from the light track or a sync leader
+void beat_bands(const float *e, uint8_t n)
+{
+	float l, odf = 0.0f;
+	int i;
+
+	if(n > BEAT_MAX_BANDS) n = BEAT_MAX_BANDS;
+	for(i = 0; i < n; i++){
+		l = log2f(1.0f + e[i]);
+		if(i < prev_bands && l > prev[i]) odf += l - prev[i];
+		prev[i] = l;
+	}
+	// the first block from a new source has nothing to rise from
+	if(prev_bands != n){
+		prev_bands = n;
+		odf = mean;
+	}
+	flux(odf);
+}
+
+// The magnitude spectrum, summed between consecutive edges
+void beat_spectrum(const float *spectrum, const uint16_t *edges, uint8_t n_edges)
+{
+	float e[BEAT_MAX_BANDS];
+	uint8_t i, n = n_edges - 1 < BEAT_MAX_BANDS ? n_edges - 1 : BEAT_MAX_BANDS;
+	uint16_t j;
+
+	for(i = 0; i < n; i++){
+		e[i] = 0.0f;
+		for(j = edges[i]; j < edges[i + 1]; j++) e[i] += spectrum[j];
+	}
+	beat_bands(e, n);
+}
+
+// A block without new bands (governor hop): the phase still moves
+void beat_hold(void)
+{
+	beat.onset = false;
+	advance();
+}
@@ -0,0 +1,291 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "esp_dsp.h"
+#include "esp_log.h"
+#include "xtensa/hal.h"
+
+#define TAG "DSP"
+
+#if CONFIG_SPECBOX_DSP_CHAIN
+
+// Output processing for the I2S task. Stages are registered once and run in
+// place over each block: the block is taken DSP_BLOCK frames at a time into a
+// planar float scratch, every stage runs over that, and it goes back to int16
+// with saturation while the envelope's sums of squares are taken. Each sample
+// is loaded and stored once however many stages there are, and the scratch is
+// small enough to stay put between stages.
+//
+// Every stage declares a budget in CPU cycles per stereo frame; registration
+// refuses a stage that would take the chain past CONFIG_SPECBOX_DSP_BUDGET_PCT
+// of the core at 44.1 kHz, and each block checks the stages against their own.
+#define DSP_IO_BUDGET				24				// conversion in and out, envelope
+#define DSP_CORE_BUDGET				(CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 1000000 / 44100 * \
+									 CONFIG_SPECBOX_DSP_BUDGET_PCT / 100)
+
+#define BIQUAD_BUDGET				40
+#define GAIN_BUDGET					8
+#define LIMITER_BUDGET				96
+
+#define BASS_SHELF_HZ				200.0f
+#define LIMITER_RELEASE_MS			80.0f
+#define LIMITER_MAX					((int)(CONFIG_SPECBOX_DSP_LOOKAHEAD_MS * 48 + 2))
+
+static dsp_stage_t chain[DSP_MAX_STAGES];
+static uint8_t chain_len = 0;
+static uint32_t chain_budget = DSP_IO_BUDGET;
+static float scratch[2][DSP_BLOCK];
+static uint32_t io_cycles, io_frames;
+
+bool dsp_chain_add(const char *name, dsp_setup_t setup, dsp_process_t process, void *state, uint16_t budget)
+{
+	dsp_stage_t *st;
+
+	if(chain_len == DSP_MAX_STAGES || chain_budget + budget > DSP_CORE_BUDGET){
+		ESP_LOGE(TAG, "Stage %s refused: %u + %u cycles/frame, chain budget %u", name,
+				chain_budget, budget, DSP_CORE_BUDGET);
+		return false;
+	}
+	st = &chain[chain_len++];
+	memset(st, 0, sizeof(*st));
+	st->name = name;
+	st->setup = setup;
+	st->process = process;
+	st->state = state;
+	st->budget = budget;
+	chain_budget += budget;
+	return true;
+}
+
+uint8_t dsp_chain_len(void)
+{
+	return chain_len;
+}
+
+void dsp_chain_rate(float rate)
+{
+	uint8_t i;
+
+	for(i = 0; i < chain_len; i++){
+		if(chain[i].setup != NULL) chain[i].setup(chain[i].state, rate);
+	}
+}
+
+// n counts samples, L and R interleaved, n even. sq: sums of squares of the
+// output per channel, then the largest square per channel.
+void dsp_chain_process(int16_t *s, size_t n, float *sq)
+{
+	float *const l = scratch[0], *const r = scratch[1];
+	float x, q, sl = 0.0f, sr = 0.0f, pl = 0.0f, pr = 0.0f;
+	size_t frames = n / 2, done, m, i;
+	uint32_t c0, c1, io = 0;
+	uint8_t k;
+
+	for(k = 0; k < chain_len; k++) chain[k].block_cycles = 0;
+	for(done = 0; done < frames; done += m){
+		m = frames - done < DSP_BLOCK ? frames - done : DSP_BLOCK;
+		c0 = xthal_get_ccount();
+		for(i = 0; i < m; i++){
+			l[i] = s[2 * (done + i)];
+			r[i] = s[2 * (done + i) + 1];
+		}
+		c1 = xthal_get_ccount();
+		io += c1 - c0;
+		for(k = 0; k < chain_len; k++){
+			chain[k].process(chain[k].state, l, r, m);
+			c0 = c1;
+			c1 = xthal_get_ccount();
+			chain[k].block_cycles += c1 - c0;
+		}
+		for(i = 0; i < m; i++){
+			x = l[i];
+			x = x > 32767.0f ? 32767.0f : (x < -32768.0f ? -32768.0f : x);
+			s[2 * (done + i)] = x;
+			q = x * x;
+			sl += q;
+			if(q > pl) pl = q;
+			x = r[i];
+			x = x > 32767.0f ? 32767.0f : (x < -32768.0f ? -32768.0f : x);
+			s[2 * (done + i) + 1] = x;
+			q = x * x;
+			sr += q;
+			if(q > pr) pr = q;
+		}
+		io += xthal_get_ccount() - c1;
+	}
+	sq[0] = sl;
+	sq[1] = sr;
+	sq[2] = pl;
+	sq[3] = pr;
+
+	io_cycles += io;
+	io_frames += frames;
+	for(k = 0; k < chain_len; k++){
+		chain[k].cycles += chain[k].block_cycles;
+		chain[k].frames += frames;
+		if(chain[k].block_cycles > (uint32_t)chain[k].budget * frames) chain[k].overruns += 1;
+	}
+}
+
+// Cycles per frame since the last log, against each budget
+void dsp_chain_log(void)
+{
+	dsp_stage_t *st;
+	uint8_t k;
+
+	if(io_frames == 0) return;
+	ESP_LOGI(TAG, "io: %u cycles/frame (budget %u)", io_cycles / io_frames, DSP_IO_BUDGET);
+	for(k = 0; k < chain_len; k++){
+		st = &chain[k];
+		if(st->frames == 0) continue;
+		ESP_LOGI(TAG, "%s: %u cycles/frame (budget %u), %u blocks over", st->name,
+				st->cycles / st->frames, st->budget, st->overruns);
+		st->cycles = st->frames = 0;
+	}
+	io_cycles = io_frames = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Built-in stages
+
+typedef struct {
+	float hz;
+	float db;						// shelf gain; unused by the high-pass
+	bool shelf;
+	float coef[5];
+	float w[2][2];
+} biquad_t;
+
+static void biquad_setup(void *state, float rate)
+{
+	biquad_t *b = state;
+
+	if(b->shelf) dsps_biquad_gen_lowShelf_f32(b->coef, b->hz / rate, b->db, 0.707f);
+	else dsps_biquad_gen_hpf_f32(b->coef, b->hz / rate, 0.707f);
+	memset(b->w, 0, sizeof(b->w));
+}
+
+static void biquad_process(void *state, float *l, float *r, size_t frames)
+{
+	biquad_t *b = state;
+
+	dsps_biquad_f32_ae32(l, l, frames, b->coef, b->w[0]);
+	dsps_biquad_f32_ae32(r, r, frames, b->coef, b->w[1]);
+}
+
+static void gain_process(void *state, float *l, float *r, size_t frames)
+{
+	const float v = *(const float *)state;
+	size_t i;
+
+	for(i = 0; i < frames; i++){
+		l[i] *= v;
+		r[i] *= v;
+	}
+}
+
+// Look-ahead peak limiter, stereo linked. The gain each frame needs is the
+// threshold over its peak; its minimum over the look-ahead window, released
+// towards 1 and then averaged over the same window, reaches that value by the
+// time the frame leaves the delay line, so peaks are caught without a click.
+typedef struct {
+	float thr;
+	float rel;						// release per frame, share of the way to 1
+	uint16_t la;					// look-ahead, frames
+	uint16_t pos;
+	uint32_t t;
+	float h, sum;
+	float delay[2][LIMITER_MAX];
+	float box[LIMITER_MAX];
+	float q_v[LIMITER_MAX];			// monotonic queue of the window's minimum
+	uint32_t q_t[LIMITER_MAX];
+	uint16_t q_head, q_len;
+} limiter_t;
+
+static void limiter_setup(void *state, float rate)
+{
+	limiter_t *lm = state;
+	uint16_t i;
+
+	lm->thr = 32768.0f * powf(10.0f, CONFIG_SPECBOX_DSP_LIMITER_DB / 20.0f);
+	lm->rel = 1.0f - expf(-1000.0f / (LIMITER_RELEASE_MS * rate));
+	lm->la = CONFIG_SPECBOX_DSP_LOOKAHEAD_MS * rate / 1000;
+	if(lm->la < 1) lm->la = 1;
+	if(lm->la > LIMITER_MAX - 1) lm->la = LIMITER_MAX - 1;
+	memset(lm->delay, 0, sizeof(lm->delay));
+	for(i = 0; i < lm->la; i++) lm->box[i] = 1.0f;
+	lm->sum = lm->la;
+	lm->h = 1.0f;
+	lm->pos = 0;
+	lm->t = 0;
+	lm->q_head = lm->q_len = 0;
+}
+
+static void limiter_process(void *state, float *l, float *r, size_t frames)
+{
+	limiter_t *lm = state;
+	float p, need, m, g, dl, dr;
+	uint16_t tail;
+	size_t i;
+
+	for(i = 0; i < frames; i++, lm->t++){
+		p = fabsf(l[i]) > fabsf(r[i]) ? fabsf(l[i]) : fabsf(r[i]);
+		need = p > lm->thr ? lm->thr / p : 1.0f;
+
+		// window minimum over the last la + 1 frames
+		if(lm->q_len > 0 && lm->t - lm->q_t[lm->q_head] > lm->la){
+			lm->q_head = (lm->q_head + 1) % LIMITER_MAX;
+			lm->q_len -= 1;
+		}
+		while(lm->q_len > 0){
+			tail = (lm->q_head + lm->q_len - 1) % LIMITER_MAX;
+			if(lm->q_v[tail] < need) break;
+			lm->q_len -= 1;
+		}
+		tail = (lm->q_head + lm->q_len) % LIMITER_MAX;
+		lm->q_v[tail] = need;
+		lm->q_t[tail] = lm->t;
+		lm->q_len += 1;
+		m = lm->q_v[lm->q_head];
+
+		g = lm->h + (1.0f - lm->h) * lm->rel;
+		lm->h = m < g ? m : g;
+		lm->sum += lm->h - lm->box[lm->pos];
+		lm->box[lm->pos] = lm->h;
+		g = lm->sum / lm->la;
+
+		dl = lm->delay[0][lm->pos];
+		dr = lm->delay[1][lm->pos];
+		lm->delay[0][lm->pos] = l[i];
+		lm->delay[1][lm->pos] = r[i];
+		l[i] = dl * g;
+		r[i] = dr * g;
+		if(++lm->pos == lm->la){
+			lm->pos = 0;
+			// the running sum drifts in float; rebuilt once per window
+			for(lm->sum = 0.0f, tail = 0; tail < lm->la; tail++) lm->sum += lm->box[tail];
+		}
+	}
+}
+
+static biquad_t hpf = { .hz = CONFIG_SPECBOX_DSP_HPF_HZ };
+static biquad_t bass = { .hz = BASS_SHELF_HZ, .db = CONFIG_SPECBOX_DSP_BASS_DB, .shelf = true };
+static limiter_t limiter;
+
+// Order: the filters ahead of the volume, the limiter last so it sees what
+// reaches the DAC
+void dsp_chain_init(const float *volume)
+{
+	if(chain_len > 0) return;
+	if(CONFIG_SPECBOX_DSP_HPF_HZ > 0) dsp_chain_add("hpf", biquad_setup, biquad_process, &hpf, BIQUAD_BUDGET);
+	if(CONFIG_SPECBOX_DSP_BASS_DB > 0) dsp_chain_add("bass", biquad_setup, biquad_process, &bass, BIQUAD_BUDGET);
+	dsp_chain_add("gain", NULL, gain_process, (void *)volume, GAIN_BUDGET);
+	dsp_chain_add("limiter", limiter_setup, limiter_process, &limiter, LIMITER_BUDGET);
+	ESP_LOGI(TAG, "%u stages, %u of %u cycles/frame", chain_len, chain_budget, DSP_CORE_BUDGET);
+}
+#endif
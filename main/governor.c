@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "esp_log.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#define TAG "GOVERNOR"
+
+// Full quality until the governor first runs, and for good when it is not built
+gov_state_t gov = { .level = GOV_FULL, .hop = 1, .fps = 0, .brightness = 255 };
+float gov_light_level = 0.0f;
+
+#if CONFIG_SPECBOX_GOVERNOR
+
+// Quality levels picked from battery state, MODE/LGT and the deadline misses of
+// the last period. A level sets the CPU ceiling, how often the analyzer runs
+// the FFT, the LED frame cap and brightness. Current figures are rough board
+// estimates (CPU with the radio up, WS2812B at full white); the amplifier is
+// not included.
+#define RADIO_MA					30
+#define LED_MA						60
+#define MISS_PERMILLE				20
+
+static const gov_level_t gov_levels[GOV_LEVEL_COUNT] = {
+	[GOV_FULL]	= { "full",		240,	1,	0,	255 },
+	[GOV_ECO]	= { "eco",		160,	1,	30,	192 },
+	[GOV_SAVER]	= { "saver",	160,	2,	20,	128 },
+	[GOV_DARK]	= { "dark",		80,		0,	0,	0 },
+	[GOV_IDLE]	= { "idle",		80,		0,	0,	0 },
+};
+
+static uint32_t last_frames, last_misses, last_underruns;
+static bool applied = false;		// the CPU settings match gov.level
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t apb_lock;
+static bool apb_held = false;
+#endif
+
+static uint16_t cpu_ma(uint16_t mhz)
+{
+	return mhz >= 240 ? 68 : mhz >= 160 ? 44 : 30;
+}
+
+uint16_t gov_current_ma(void)
+{
+	const gov_level_t *l = &gov_levels[gov.level];
+	uint16_t ma = cpu_ma(l->cpu_mhz);
+
+	if(gov.level != GOV_IDLE) ma += RADIO_MA;
+	if(gov.level != GOV_DARK && gov.level != GOV_IDLE){
+		ma += N_LED * LED_MA * (l->brightness / 255.0f) * gov_light_level;
+	}
+	return ma;
+}
+
+static void gov_apply(uint8_t level)
+{
+	const gov_level_t *l = &gov_levels[level];
+	bool changed = !applied || level != gov.level;
+
+	applied = true;
+	gov.level = level;
+	gov.hop = l->hop;
+	gov.fps = l->fps;
+	gov.brightness = l->brightness;
+#if CONFIG_PM_ENABLE
+	esp_pm_config_esp32_t pm = {
+		.max_freq_mhz = l->cpu_mhz,
+		.min_freq_mhz = 80,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+		.light_sleep_enable = level == GOV_IDLE,
+#endif
+	};
+	if(changed && esp_pm_configure(&pm) != ESP_OK) ESP_LOGW(TAG, "Can't apply %s", l->name);
+#endif
+	if(changed){
+		ESP_LOGI(TAG, "Level %s: %u MHz, hop %u, %u fps, brightness %u, ~%u mA",
+				l->name, l->cpu_mhz, l->hop, l->fps, l->brightness, gov_current_ma());
+	}
+}
+
+static uint32_t underruns(void)
+{
+	uint32_t n = 0;
+	int i;
+	for(i = 0; i < LATENCY_PROFILE_COUNT; i++) n += profile_stats[i].underruns;
+	return n;
+}
+
+// Called from sensor_task every period and whenever MODE or LGT change
+void governor_update(void)
+{
+	uint32_t frames = deadline_stats.light_frames - last_frames;
+	uint32_t misses = deadline_stats.light_misses - last_misses;
+	uint32_t under = underruns() - last_underruns;
+	uint8_t level;
+
+	last_frames = deadline_stats.light_frames;
+	last_misses = deadline_stats.light_misses;
+	last_underruns = underruns();
+
+	if(MODE == NO_MODE && LGT == LIGHT_OFF) level = GOV_IDLE;
+	else if(LGT == LIGHT_OFF) level = GOV_DARK;
+	else if(battery_soc == BATTERY_SOC_UNKNOWN || battery_soc > CONFIG_SPECBOX_GOV_ECO_SOC) level = GOV_FULL;
+	else if(battery_soc > CONFIG_SPECBOX_GOV_SAVER_SOC) level = GOV_ECO;
+	else level = GOV_SAVER;
+
+	// the show is falling behind at this level: give it one step more
+	if(level > GOV_FULL && level <= GOV_SAVER && (under > 0 || misses * 1000 > frames * MISS_PERMILLE)){
+		level -= 1;
+	}
+	gov_apply(level);
+}
+
+void governor_kick(void)
+{
+	if(sensor_handle != NULL) xTaskNotify(sensor_handle, GOV_KICK, eSetValueWithoutOverwrite);
+}
+
+// RMT and LEDC run from APB, so its frequency stays fixed while the box is
+// awake; only the CPU clock scales.
+void governor_wake(void)
+{
+#if CONFIG_PM_ENABLE
+	if(apb_lock == NULL) esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "specbox", &apb_lock);
+	if(!apb_held) esp_pm_lock_acquire(apb_lock);
+	apb_held = true;
+#endif
+	gov_apply(GOV_FULL);
+}
+
+void governor_sleep(void)
+{
+	gov_apply(GOV_IDLE);
+#if CONFIG_PM_ENABLE
+	if(apb_held) esp_pm_lock_release(apb_lock);
+	apb_held = false;
+#endif
+}
+#endif
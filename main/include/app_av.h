@@ -37,4 +37,9 @@ void bt_app_rc_ct_cb(esp_avrc_ct_cb_event_t event, esp_avrc_ct_cb_param_t *param
  */
 void bt_app_rc_tg_cb(esp_avrc_tg_cb_event_t event, esp_avrc_tg_cb_param_t *param);
 
+/**
+ * @brief     feeds A2DP connection and profile events to the mode switch state machine
+ */
+void mode_a2d_event(uint16_t event, esp_a2d_cb_param_t *a2d);
+
 #endif /* __BT_APP_AV_H__*/
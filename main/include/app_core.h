@@ -6,10 +6,14 @@
 #include <stdio.h>
 #include <math.h>
 #include "driver/dac.h"
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 #include "freertos/ringbuf.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/event_groups.h"
 
 //--------------------- PIN CONFIG -------------------------------
 
@@ -45,9 +49,22 @@
 #define BLUETOOTH_MODE 						15
 #define LIGHT_ON							20
 #define LIGHT_OFF							25
+#define LIGHT_VU							30
 #define COMMAND_MODE_ACTIVE 				100
 #define COMMAND_MODE_ACCEPTED 				101
 #define COMMAND_MODE_INACTIVE 				102
+#define LATENCY_PROFILE						40
+#define MEM_REPORT							45
+#define TRACE_FLUSH							48
+#define SYNC_ROLE							55
+
+#define CMD_FRAME_SYNC						0xA5
+#define CMD_PROTO_VERSION					1
+#define CMD_FRAME_MAX						64
+#define CMD_STREAM_SIZE						256
+#define CMD_WINDOW_MS						15000
+#define SYNC_FRAME_SYNC						0xA6
+#define SYNC_PROTO_VERSION					1
 
 #define CHUNK_SIZE 							1024
 #define CSIZE	 							4096
@@ -55,6 +72,7 @@
 
 #define CRITICAL_CHARGE_BOUND 				560
 #define LOW_CHARGE_BOUND 					590
+#define FULL_CHARGE_BOUND 					700
 
 #define CRG_CONN							85
 #define CRG_DISCONN							90
@@ -75,7 +93,19 @@
 extern xSemaphoreHandle cdat_semaphore;
 
 extern xQueueHandle s_app_task_queue;
-extern xQueueHandle command_queue;
+extern StreamBufferHandle_t command_stream;
+extern uint32_t cmd_rx_dropped;
+extern xSemaphoreHandle cmd_rx_sem;
+extern int64_t get_cmd_rx_stamp(void);
+
+// SPP receive to completion of the dispatched action
+typedef struct {
+	uint32_t commands;
+	uint32_t max_us;
+	uint64_t total_us;
+} cmd_stats_t;
+
+extern cmd_stats_t cmd_stats;
 extern xTaskHandle s_i2s_task_handle;
 extern xTaskHandle def_handle;
 extern xTaskHandle color_handle;
@@ -85,10 +115,43 @@ extern RingbufHandle_t audio_channel;
 
 extern bool STL_STATE;
 extern bool OVL_STATE;
+extern bool TRK_STATE;
+extern uint8_t col_track[HN_LED];
+extern int64_t get_col_due(void);
+extern uint32_t sync_latency_ms;
+extern uint8_t drift_fill;
+// output level per channel as it reaches the DAC, -48..0 dBFS onto 0..255
+extern uint8_t env_level[2];
+extern int32_t drift_ppm;
 static const int i2s_out_num = 0;
 extern uint16_t MODE;
+extern uint16_t LGT;
+
+#define LATENCY_LOW							0
+#define LATENCY_ROBUST						1
+#define LATENCY_PROFILE_COUNT				2
+
+typedef struct {
+	const char *name;
+	uint16_t dma_buf_count;
+	uint16_t dma_buf_len;
+	uint16_t ring_bytes;
+	uint16_t rx_timeout_ms;
+} latency_profile_t;
+
+typedef struct {
+	uint32_t blocks;
+	uint32_t underruns;
+	uint64_t latency_us;
+} profile_stats_t;
+
+extern const latency_profile_t latency_profiles[LATENCY_PROFILE_COUNT];
+extern profile_stats_t profile_stats[LATENCY_PROFILE_COUNT];
+extern uint8_t latency_profile;
+extern void request_latency_profile(uint8_t profile);
 
 #define APP_SIG_WORK_DISPATCH          (0x01)
+#define APP_SIG_STOP                   (0x02)
 
 typedef void (* app_cb_t) (uint16_t event, void *param);
 
@@ -97,8 +160,61 @@ typedef struct {
     uint16_t event;
     app_cb_t cb;
     void *param;
+    int64_t stamp;
 } app_msg_t;
 
+#define TASK_DISPATCH						0
+#define TASK_I2S							1
+#define TASK_DEFAULT						2
+#define TASK_COLOR							3
+#define TASK_CMD							4
+#define TASK_SENSOR							5
+#define TASK_SERVO							6
+#if CONFIG_SPECBOX_STRESS_BENCH
+#define TASK_STRESS							7
+#define TASK_COUNT							8
+#else
+#define TASK_COUNT							7
+#endif
+
+// Workers set their bit in task_exit_group as they exit
+#define TASK_BIT(id)						(1 << (id))
+#define SHUTDOWN_TIMEOUT_MS					3000
+
+typedef struct {
+	const char *name;
+	TaskFunction_t fn;
+	uint32_t stack;
+	UBaseType_t prio;
+	BaseType_t core;
+} task_slot_t;
+
+#define DISPATCH_DEADLINE_US				100000
+#define LIGHT_DEADLINE_US					(CSIZE * 250000LL / 44100)
+
+typedef struct {
+	uint32_t light_frames;
+	uint32_t light_misses;
+	uint32_t dispatch_msgs;
+	uint32_t dispatch_misses;
+	uint32_t dispatch_max_us;
+} deadline_stats_t;
+
+extern deadline_stats_t deadline_stats;
+
+#define BOOT_WAKE							0
+#define BOOT_TASKS							1
+#define BOOT_PREFETCH						2
+#define BOOT_ANALYZER						3
+#define BOOT_SERVO							4
+#define BOOT_FIRST_AUDIO					5
+#define BOOT_FIRST_LIGHT					6
+#define BOOT_PHASE_COUNT					7
+
+extern int64_t boot_phase[BOOT_PHASE_COUNT];
+extern void boot_begin(void);
+extern void boot_mark(uint8_t phase);
+
 bool app_work_dispatch(app_cb_t p_cback, uint16_t event, void *p_params, int param_len);
 
 extern void app_task_start_up(void);
@@ -107,20 +223,270 @@ extern void i2s_task_start_up(void);
 extern void i2s_task_shut_down(void);
 extern void cmpl_tasks_start_up(uint16_t event, void *param);
 extern void cmpl_tasks_shut_down(uint16_t event, void *param);
+extern bool start_task(uint8_t id, void *arg, xTaskHandle *handle);
+extern void task_exit(uint8_t id);
+extern bool task_join(EventBits_t bits, uint32_t timeout_ms);
+extern bool cmpl_tasks_join(uint32_t timeout_ms);
+extern bool app_work_drain(uint32_t timeout_ms);
+
+// stack_free is the lowest headroom seen per task slot, in bytes
+typedef struct {
+	uint32_t stack_free[TASK_COUNT];
+	uint32_t internal_free;
+	uint32_t internal_largest;
+	uint32_t internal_min;
+	uint32_t spiram_free;
+} mem_stats_t;
+
+extern mem_stats_t mem_stats;
+extern const size_t dsp_work_size;
+extern void mem_sample(void);
+
+#define BATTERY_SOC_UNKNOWN					0xFF
+#define BAT_EVT_CRG_CONN					(1 << 0)
+#define BAT_EVT_CRG_DISCONN					(1 << 1)
+#define BAT_EVT_LOW							(1 << 2)
+#define BAT_EVT_CRITICAL					(1 << 3)
 
+extern uint8_t battery_soc;
+extern int battery_raw;
+extern void battery_init(void);
+extern uint8_t battery_update(void);
+
+#define GOV_FULL							0
+#define GOV_ECO								1
+#define GOV_SAVER							2
+#define GOV_DARK							3
+#define GOV_IDLE							4
+#define GOV_LEVEL_COUNT						5
+#define GOV_KICK							4441
+
+// hop: analyze every n-th block (0: lights off), fps: LED frame cap (0: none)
+typedef struct {
+	const char *name;
+	uint16_t cpu_mhz;
+	uint8_t hop;
+	uint8_t fps;
+	uint8_t brightness;
+} gov_level_t;
+
+typedef struct {
+	uint8_t level;
+	uint8_t hop;
+	uint8_t fps;
+	uint8_t brightness;
+} gov_state_t;
+
+#define MODE_STEP_TIMEOUT_MS				3000
+
+// Last mode switch: time until the new source plays and until Bluetooth settled
+typedef struct {
+	uint16_t from;
+	uint16_t to;
+	int64_t start_us;
+	int64_t audio_us;
+	int64_t settled_us;
+} mode_transition_t;
+
+extern mode_transition_t mode_transition;
+
+extern gov_state_t gov;
+extern float gov_light_level;
+#if CONFIG_SPECBOX_GOVERNOR
+extern uint16_t gov_current_ma(void);
+extern void governor_update(void);
+extern void governor_kick(void);
+extern void governor_wake(void);
+extern void governor_sleep(void);
+#endif
+extern int mem_report(char *buf, size_t len);
+
+#define PERSIST_DEFAULT_VOLUME				5
+#define PERSIST_LIGHT_FRAMES				256
+
+// process_colors' adaptive normalization, smoothing and color cycle
+typedef struct {
+	float max[HN_LED];
+	float min[HN_LED];
+	float cs[HN_LED];
+	float rate[HN_LED];
+	uint8_t l_color[3];
+	uint8_t h_color[3];
+	bool l_slope;
+	bool h_slope;
+	uint8_t lci;
+	uint8_t hci;
+} light_state_t;
+
+typedef struct {
+	uint8_t volume;
+	uint16_t mode;
+	uint32_t writes;
+} persist_t;
+
+extern persist_t persist;
+extern void persist_init(void);
+extern bool persist_light_get(light_state_t *ls);
+extern void persist_light_put(const light_state_t *ls);
+extern void persist_set_volume(uint8_t volume);
+extern void persist_set_mode(uint16_t mode);
+extern void persist_tick(void);
+extern void persist_save(void);
+
+// Output processing chain, see dsp_chain.c. l and r: planar float, int16 scale
+#define DSP_MAX_STAGES						6
+#define DSP_BLOCK							64
+
+typedef void (*dsp_setup_t)(void *state, float rate);
+typedef void (*dsp_process_t)(void *state, float *l, float *r, size_t frames);
+
+typedef struct {
+	const char *name;
+	dsp_setup_t setup;
+	dsp_process_t process;
+	void *state;
+	uint16_t budget;					// cycles per stereo frame
+	uint32_t block_cycles;
+	uint32_t cycles;
+	uint32_t frames;
+	uint32_t overruns;					// blocks over budget
+} dsp_stage_t;
+
+extern bool dsp_chain_add(const char *name, dsp_setup_t setup, dsp_process_t process, void *state, uint16_t budget);
+extern void dsp_chain_init(const float *volume);
+extern uint8_t dsp_chain_len(void);
+extern void dsp_chain_rate(float rate);
+extern void dsp_chain_process(int16_t *s, size_t n, float *sq);
+extern void dsp_chain_log(void);
+
+#define BEAT_MAX_BANDS						96
+
+typedef struct {
+	float bpm;
+	float phase;						// 0..1, 0 on the beat
+	float confidence;					// 0..1, how periodic the onsets are
+	float pulse;						// 0..1, decays over each beat, scaled by confidence
+	float strength;						// of the onset, in deviations
+	bool onset;
+	bool beat;							// the phase wrapped this block
+	uint32_t count;
+} beat_t;
+
+extern beat_t beat;
+extern void beat_reset(void);
+extern void beat_spectrum(const float *spectrum, const uint16_t *edges, uint8_t n_edges);
+extern void beat_bands(const float *e, uint8_t n);
+extern void beat_hold(void);
+#if CONFIG_SPECBOX_SOAK_CYCLES > 0
+extern void soak_run(uint32_t cycles);
+#endif
+
+#if CONFIG_SPECBOX_TRACE
+#define TRC_AUDIO							1
+#define TRC_CMD								2
+#define TRC_DISPATCH						3
+#define TRC_LIGHT							4
+#define TRC_SHOW							5
+
+// TRC_AUDIO arg
+#define TRC_SRC_PCM							0
+#define TRC_SRC_TRACK						1
+// TRC_LIGHT arg: where the bands of the frame came from
+#define TRC_BANDS_FFT						0
+#define TRC_BANDS_TRACK						1
+#define TRC_BANDS_HELD						2
+#define TRC_BANDS_SILENCE					3
+#define TRC_BANDS_SYNC						4
+
+// seq ties a light frame to the audio block it was computed from
+typedef struct __attribute__((packed)) {
+	uint16_t seq;
+	uint16_t size;
+	uint16_t ring_room;
+} trc_audio_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t event;
+	uint32_t cb;
+	uint32_t wait_us;
+	uint32_t run_us;
+} trc_dispatch_t;
+
+// lift: the beat flash applied to every pair, which the replay cannot derive
+typedef struct __attribute__((packed)) {
+	uint16_t seq;
+	float lift;
+	uint8_t rgb[HN_LED][3];
+	uint8_t neon[2];
+} trc_light_t;
+
+// arg: 1 if shown, 0 if dropped by the frame cap
+typedef struct __attribute__((packed)) {
+	int32_t late_us;
+	uint8_t brightness;
+} trc_show_t;
+
+extern uint16_t col_seq;
+extern void trace_put(uint8_t type, uint8_t arg, const void *data, size_t len);
+extern void trace_put2(uint8_t type, uint8_t arg, const void *a, size_t a_len, const void *b, size_t b_len);
+extern void trace_flush(uint16_t event, void *param);
+#endif
+
+typedef struct {
+	uint32_t sent;
+	uint32_t dropped;
+	uint32_t dropped_bytes;
+	uint32_t stretched;
+} ingress_stats_t;
+
+extern ingress_stats_t ingress_stats;
+
+extern void cmd_rx(const uint8_t *data, size_t len);
+extern void cmd_task_abort(void);
+extern bool spp_frame_send(uint8_t sync, uint8_t version, const uint8_t *payload, uint8_t len);
 extern void write_ringbuf(const uint8_t *data, size_t size);
+extern void write_ringbuf_nb(const uint8_t *data, size_t size);
+extern void write_ringbuf_track(const uint8_t *data, size_t size, const uint8_t *bands);
+extern bool write_ringbuf_narrate(const uint8_t *data, size_t size);
+extern uint32_t pipeline_latency_us(void);
 extern void init_ext_storage();
+#if CONFIG_SPECBOX_LOG_DEFER
+extern void log_defer_init(void);
+#endif
+extern void narrate_prefetch(void);
 
 extern void cmd_active(uint16_t event, void *param);
 extern void set_mode(uint16_t event, void *param);
+extern bool mode_wait_idle(uint32_t timeout_ms);
 extern void change_volume(uint16_t event, void *param);
+extern void set_latency_profile(uint16_t event, void *param);
 extern void indirect_narrate(uint16_t event, void *param);
 extern void overlay_battery_status(uint16_t event, void *param);
 extern void set_light(uint16_t event, void *param);
+extern void set_sync_role(uint16_t event, void *param);
+
+extern void sync_link_init(void);
+extern void sync_link_rx(const uint8_t *msg, uint8_t len, int64_t stamp);
+extern void sync_link_lead(int64_t *due, const float *cd);
+extern bool sync_link_poll(int64_t now);
+extern TickType_t sync_link_wait(int64_t now, TickType_t max);
+extern bool sync_link_follow(int64_t now, float *cd, int64_t *due);
 
 extern void play_default(void* param);
 extern void process_colors(void *param);
 extern void sensor_task(void *arg);
 extern void cmd_cb_task(void *arg);
+extern xTaskHandle servo_handle;
+extern void servo_task(void *arg);
+
+typedef void (* servo_done_cb_t) (void *arg);
+
+extern void servo_motion_init(float angle);
+extern void servo_motion_deinit(void);
+extern bool servo_motion_start(float from, float to, uint32_t duration_ms, servo_done_cb_t cb, void *arg);
+#if CONFIG_SPECBOX_STRESS_BENCH
+extern xTaskHandle stress_handle;
+extern void stress_task(void *arg);
+#endif
 
 #endif /* __APP_CORE_H__ */
@@ -0,0 +1,43 @@
+#ifndef __SD_STREAM_H__
+#define __SD_STREAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sdmmc_cmd.h"
+
+// Streaming reads of a large file on the card. When the file's clusters are
+// contiguous its first sector is found once through FatFs at open, and reads
+// then go straight to the card as multi-block reads into a DMA-capable buffer,
+// with no cluster chain walks or stdio copies. A fragmented file is read through
+// stdio into the same buffer. Reads hand out pointers into the buffer, which
+// stay valid until the next read.
+//
+// One stream at a time: the buffer is shared.
+//
+// FatFs is built without FF_FS_REENTRANT and VFS-FAT keeps its volume lock to
+// itself, so the FatFs calls and sector reads made here would race stdio on the
+// card from other tasks. Every card access in the firmware, stdio included,
+// holds sd_lock instead; none of them blocks on anything else while holding it.
+
+#define SD_STREAM_BYTES						(CONFIG_SPECBOX_SD_STREAM_KB * 1024)
+
+typedef struct {
+	uint32_t sector;				// first sector, 0: not contiguous, read through f
+	uint32_t size;
+	uint32_t buf_pos;				// file offset of the buffer's first byte
+	uint32_t buf_len;
+	FILE *f;
+} sd_stream_t;
+
+extern void sd_stream_init(sdmmc_card_t *card);
+extern void sd_lock(void);
+extern void sd_unlock(void);
+extern bool sd_stream_open(sd_stream_t *s, const char *path);
+extern const uint8_t *sd_stream_read(sd_stream_t *s, uint32_t pos, size_t len);
+extern void sd_stream_close(sd_stream_t *s);
+#if CONFIG_SPECBOX_SD_BENCH
+extern void sd_stream_bench(const char *path);
+#endif
+
+#endif /* __SD_STREAM_H__ */
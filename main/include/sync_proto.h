@@ -0,0 +1,110 @@
+#ifndef __SYNC_PROTO_H__
+#define __SYNC_PROTO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Leader/follower light sync between boxes. The leader sends its analyzer's band
+// energies stamped with the time (its clock) their audio reaches its DAC;
+// followers map the stamp onto their own clock and show the frame then, instead
+// of analyzing. Followers estimate the clock offset NTP style, keeping the sample
+// with the shortest round trip out of the last SYNC_CLOCK_WINDOW.
+//
+// Plain C with no RTOS or IDF calls: the caller passes the time in, serializes
+// the calls and supplies the transport, so the same code runs on the box over
+// SPP and on the host over a loopback.
+//
+// Messages, little endian:
+//   FRAME  type seq due[4] bands[SYNC_BANDS]     due: low 32 bits of leader us
+//   PING   type id seq t1[8]                       t1: follower send time
+//   PONG   type id seq t1[8] t2[8] t3[8]           t2/t3: leader receive/send
+
+#define SYNC_BANDS							9
+#define SYNC_BAND_SCALE						8
+
+#define SYNC_ROLE_OFF						0
+#define SYNC_ROLE_LEADER					1
+#define SYNC_ROLE_FOLLOWER					2
+
+#define SYNC_MSG_FRAME						1
+#define SYNC_MSG_PING						2
+#define SYNC_MSG_PONG						3
+
+#define SYNC_FRAME_LEN						(6 + SYNC_BANDS)
+#define SYNC_PING_LEN						11
+#define SYNC_PONG_LEN						27
+#define SYNC_MSG_MAX						SYNC_PONG_LEN
+
+#define SYNC_CLOCK_WINDOW					16
+#define SYNC_CLOCK_MIN						3
+#define SYNC_JITTER_LEN						16
+#define SYNC_LOSS_US						1000000
+
+// clock: the node's time in us, read when a pong goes out
+typedef struct {
+	void *ctx;
+	void (*send)(void *ctx, const uint8_t *msg, size_t len);
+	int64_t (*clock)(void *ctx);
+} sync_transport_t;
+
+typedef struct {
+	int64_t due;						// local clock
+	uint8_t seq;
+	uint8_t bands[SYNC_BANDS];
+} sync_frame_t;
+
+typedef struct {
+	int64_t offset;						// leader clock minus local clock
+	int64_t rtt;
+} sync_sample_t;
+
+typedef struct {
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t frames_tx;
+	uint32_t frames_rx;
+	uint32_t frames_shown;
+	uint32_t frames_late;				// shown or dropped more than late_us after due
+	uint32_t frames_skipped;			// overtaken by a newer due frame
+	uint32_t pings;
+	uint32_t pongs;
+} sync_stats_t;
+
+typedef struct {
+	uint8_t role;
+	uint8_t id;
+	const sync_transport_t *tp;
+	int64_t playout_us;					// leader: added to every due time it sends
+	int64_t late_us;
+	uint8_t frame_seq;
+	uint8_t ping_seq;
+	int64_t ping_t1;
+	sync_sample_t samples[SYNC_CLOCK_WINDOW];
+	uint8_t n_samples;
+	uint8_t sample_pos;
+	int64_t offset;
+	int64_t rtt;
+	int64_t last_frame;
+	sync_frame_t jitter[SYNC_JITTER_LEN];
+	uint8_t jitter_count;
+	sync_stats_t stats;
+} sync_node_t;
+
+extern void sync_init(sync_node_t *n, uint8_t role, uint8_t id, const sync_transport_t *tp,
+		int64_t playout_us, int64_t late_us);
+extern void sync_rx(sync_node_t *n, const uint8_t *msg, size_t len, int64_t now);
+// leader: sends the frame and returns when to show it locally
+extern int64_t sync_send_frame(sync_node_t *n, int64_t due, const uint8_t *bands);
+// follower
+extern void sync_send_ping(sync_node_t *n, int64_t now);
+extern bool sync_synced(const sync_node_t *n);
+extern bool sync_following(const sync_node_t *n, int64_t now);
+extern bool sync_pop(sync_node_t *n, int64_t now, sync_frame_t *out);
+extern int64_t sync_next_due(const sync_node_t *n);
+
+// band energy to and from the light-track quantization, q = log2(1 + E) * SCALE
+extern uint8_t sync_band_q(float e);
+extern float sync_band_e(uint8_t q);
+
+#endif /* __SYNC_PROTO_H__ */
@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "esp_log.h"
+#include "xtensa/hal.h"
+
+#define TAG "LOG"
+
+#if CONFIG_SPECBOX_LOG_DEFER
+
+// Deferred log output. Installed as the esp_log vprintf, so every ESP_LOGx
+// call site stays as it is, the Bluetooth stack's included. The caller only
+// records the format string's address and the raw arguments into a slot of a
+// lock-free ring (a bounded queue with a sequence number per slot, claimed by
+// compare-and-swap); a low-priority task formats the slots and writes them out.
+// Strings are copied, since they may not outlive the call. A full ring drops
+// the line and counts it; nothing waits on the UART.
+#define LOG_SLOTS					CONFIG_SPECBOX_LOG_SLOTS
+#define LOG_ARG_BYTES				84
+#define LOG_LINE					256
+#define LOG_POLL_MS					50
+#define LOG_STACK					3072
+#define LOG_PRIO					1
+#if CONFIG_SPECBOX_TASK_PLACEMENT_PINNED
+#define LOG_CORE					CONFIG_SPECBOX_CONTROL_CORE
+#else
+#define LOG_CORE					tskNO_AFFINITY
+#endif
+#define LOG_BENCH_CALLS				16
+
+#if LOG_SLOTS & (LOG_SLOTS - 1)
+#error "CONFIG_SPECBOX_LOG_SLOTS must be a power of two"
+#endif
+
+// argument kinds, in the order the format takes them
+#define ARG_NONE					0
+#define ARG_INT						1
+#define ARG_LLONG					2
+#define ARG_DOUBLE					3
+#define ARG_PTR						4
+#define ARG_STR						5
+
+typedef struct {
+	volatile uint32_t seq;
+	const char *fmt;
+	uint16_t len;					// argument bytes used
+	bool cut;						// arguments past len did not fit
+	uint8_t args[LOG_ARG_BYTES];
+} log_slot_t;
+
+static log_slot_t ring[LOG_SLOTS];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t dropped = 0;
+static vprintf_like_t log_out = NULL;
+static bool log_direct = false;
+static StaticTask_t log_tcb;
+static StackType_t log_stack[LOG_STACK];
+
+// One conversion from *f: copies it into spec (when given) and returns the kind
+// of argument it takes; *star counts '*' widths and precisions, each an int.
+static uint8_t next_spec(const char **f, char *spec, uint8_t *star)
+{
+	const char *s = *f, *p = s + 1;
+	uint8_t wide = 0, kind;
+	size_t n;
+
+	*star = 0;
+	while(*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+	for(; (*p >= '0' && *p <= '9') || *p == '*' || *p == '.'; p++) if(*p == '*') *star += 1;
+	// long and size_t are an int on the ESP32, not on the host
+	for(; *p == 'l' || *p == 'h' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L'; p++){
+		if(*p == 'j' || (*p != 'h' && *p != 'L' && sizeof(long) > sizeof(int))) wide = 2;
+		else if(*p == 'l') wide += 1;
+	}
+	switch(*p){
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		kind = wide >= 2 ? ARG_LLONG : ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		kind = ARG_DOUBLE;
+		break;
+	case 'p':
+		kind = ARG_PTR;
+		break;
+	case 's':
+		kind = ARG_STR;
+		break;
+	default:
+		kind = ARG_NONE;			// %% and anything unknown, printed as it is
+		break;
+	}
+	if(*p != 0) p++;
+	if(spec != NULL){
+		n = p - s < 15 ? p - s : 15;
+		memcpy(spec, s, n);
+		spec[n] = 0;
+	}
+	*f = p;
+	return kind;
+}
+
+static bool put(log_slot_t *sl, const void *v, size_t n)
+{
+	if(sl->cut || sl->len + n > LOG_ARG_BYTES){
+		sl->cut = true;
+		return false;
+	}
+	memcpy(sl->args + sl->len, v, n);
+	sl->len += n;
+	return true;
+}
+
+static int log_defer_vprintf(const char *fmt, va_list ap)
+{
+	log_slot_t *sl;
+	const char *f = fmt, *str;
+	uint32_t pos, seq;
+	int32_t d;
+	uint8_t kind, star;
+	int i;
+	long long ll;
+	double x;
+	void *ptr;
+	size_t n;
+
+	if(log_direct) return log_out(fmt, ap);
+	pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	for(;;){
+		sl = &ring[pos & (LOG_SLOTS - 1)];
+		seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+		d = (int32_t)(seq - pos);
+		if(d == 0){
+			if(__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+		else if(d < 0){
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		else pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	}
+
+	sl->fmt = fmt;
+	sl->len = 0;
+	sl->cut = false;
+	while((f = strchr(f, '%')) != NULL){
+		kind = next_spec(&f, NULL, &star);
+		for(; star > 0; star--){
+			i = va_arg(ap, int);
+			put(sl, &i, sizeof(i));
+		}
+		switch(kind){
+		case ARG_INT:
+			i = va_arg(ap, int);
+			put(sl, &i, sizeof(i));
+			break;
+		case ARG_LLONG:
+			ll = va_arg(ap, long long);
+			put(sl, &ll, sizeof(ll));
+			break;
+		case ARG_DOUBLE:
+			x = va_arg(ap, double);
+			put(sl, &x, sizeof(x));
+			break;
+		case ARG_PTR:
+			ptr = va_arg(ap, void *);
+			put(sl, &ptr, sizeof(ptr));
+			break;
+		case ARG_STR:
+			// as much of the string as fits, always terminated
+			str = va_arg(ap, const char *);
+			if(str == NULL) str = "(null)";
+			n = strlen(str);
+			if(sl->len + n + 1 > LOG_ARG_BYTES && sl->len < LOG_ARG_BYTES) n = LOG_ARG_BYTES - sl->len - 1;
+			if(put(sl, str, n)) put(sl, "", 1);
+			break;
+		}
+	}
+	__atomic_store_n(&sl->seq, pos + 1, __ATOMIC_RELEASE);
+	return sl->len;
+}
+
+static int emit(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = log_out(fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+// Each conversion is printed on its own with its typed argument, '*' widths
+// written into it, so the line comes out as printf would have made it
+static void format_slot(const log_slot_t *sl, char *line)
+{
+	const char *f = sl->fmt, *lit;
+	const uint8_t *a = sl->args, *end = sl->args + sl->len;
+	char spec[16], conv[40], *c;
+	size_t n = 0;
+	uint8_t kind, star;
+	int i;
+	long long ll;
+	double x;
+	void *ptr;
+
+	while(*f != 0 && n < LOG_LINE - 1){
+		if(*f != '%'){
+			lit = strchr(f, '%');
+			if(lit == NULL) lit = f + strlen(f);
+			i = lit - f < LOG_LINE - 1 - n ? lit - f : LOG_LINE - 1 - n;
+			memcpy(line + n, f, i);
+			n += i;
+			f = lit;
+			continue;
+		}
+		kind = next_spec(&f, spec, &star);
+		for(lit = spec, c = conv; *lit != 0; lit++){
+			if(*lit != '*') *c++ = *lit;
+			else if(a + sizeof(i) > end) goto cut;
+			else{
+				memcpy(&i, a, sizeof(i));
+				a += sizeof(i);
+				c += sprintf(c, "%d", i);
+			}
+		}
+		*c = 0;
+		switch(kind){
+		case ARG_INT:
+			if(a + sizeof(i) > end) goto cut;
+			memcpy(&i, a, sizeof(i));
+			a += sizeof(i);
+			n += snprintf(line + n, LOG_LINE - n, conv, i);
+			break;
+		case ARG_LLONG:
+			if(a + sizeof(ll) > end) goto cut;
+			memcpy(&ll, a, sizeof(ll));
+			a += sizeof(ll);
+			n += snprintf(line + n, LOG_LINE - n, conv, ll);
+			break;
+		case ARG_DOUBLE:
+			if(a + sizeof(x) > end) goto cut;
+			memcpy(&x, a, sizeof(x));
+			a += sizeof(x);
+			n += snprintf(line + n, LOG_LINE - n, conv, x);
+			break;
+		case ARG_PTR:
+			if(a + sizeof(ptr) > end) goto cut;
+			memcpy(&ptr, a, sizeof(ptr));
+			a += sizeof(ptr);
+			n += snprintf(line + n, LOG_LINE - n, conv, ptr);
+			break;
+		case ARG_STR:
+			if(a >= end) goto cut;
+			n += snprintf(line + n, LOG_LINE - n, conv, (const char *)a);
+			a += strlen((const char *)a) + 1;
+			break;
+		default:
+			n += snprintf(line + n, LOG_LINE - n, "%s", strcmp(conv, "%%") == 0 ? "%" : conv);
+			break;
+		}
+		if(n > LOG_LINE - 1) n = LOG_LINE - 1;
+	}
+	line[n] = 0;
+	return;
+cut:
+	// the arguments ran out of room: the rest of the format is left off
+	snprintf(line + n, LOG_LINE - n, "...\n");
+}
+
+static void log_task(void *arg)
+{
+	static char line[LOG_LINE];
+	log_slot_t *sl;
+	uint32_t seen = 0, d;
+
+	for(;;){
+		sl = &ring[tail & (LOG_SLOTS - 1)];
+		if(__atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE) != tail + 1){
+			d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+			if(d != seen){
+				emit("W (%u) %s: %u lines dropped\n", esp_log_timestamp(), TAG, d - seen);
+				seen = d;
+			}
+			vTaskDelay(LOG_POLL_MS / portTICK_PERIOD_MS);
+			continue;
+		}
+		format_slot(sl, line);
+		__atomic_store_n(&sl->seq, tail + LOG_SLOTS, __ATOMIC_RELEASE);
+		tail += 1;
+		emit("%s", line);
+	}
+}
+
+#if CONFIG_SPECBOX_LOG_BENCH
+// Cycles per ESP_LOGI with a typical event line, recorded and written out
+// on the spot. Both include esp_log's level check.
+static void log_bench(void)
+{
+	uint32_t c0, c_defer, c_direct;
+	int k;
+
+	c0 = xthal_get_ccount();
+	for(k = 0; k < LOG_BENCH_CALLS; k++) ESP_LOGI(TAG, "bench %d: event %d, param %p", k, k * 3, &c0);
+	c_defer = xthal_get_ccount() - c0;
+	log_direct = true;
+	c0 = xthal_get_ccount();
+	for(k = 0; k < LOG_BENCH_CALLS; k++) ESP_LOGI(TAG, "bench %d: event %d, param %p", k, k * 3, &c0);
+	c_direct = xthal_get_ccount() - c0;
+	log_direct = false;
+	ESP_LOGI(TAG, "ESP_LOGI: %u cycles deferred, %u written out", c_defer / LOG_BENCH_CALLS, c_direct / LOG_BENCH_CALLS);
+}
+#endif
+
+void log_defer_init(void)
+{
+	uint32_t i;
+
+	if(log_out != NULL) return;
+	for(i = 0; i < LOG_SLOTS; i++) ring[i].seq = i;
+	xTaskCreateStaticPinnedToCore(log_task, "log_task", LOG_STACK, NULL, LOG_PRIO, log_stack, &log_tcb, LOG_CORE);
+	log_out = esp_log_set_vprintf(log_defer_vprintf);
+#if CONFIG_SPECBOX_LOG_BENCH
+	log_bench();
+#endif
+}
+#endif
@@ -1,5 +1,6 @@
 #include <app_core.h>
 #include <app_av.h>
+#include <sync_proto.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
@@ -25,8 +26,9 @@
 #include "driver/rmt.h"
 #include "led_strip.h"
 #include "driver/gpio.h"
-#include "iot_servo.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
 
 static const char* TAG = "MAIN";
 
@@ -34,112 +36,352 @@ static const char* TAG = "MAIN";
 #define WAKEUP_BIT ( 1 << 2)
 #define SLEEP_BIT ( 1 << 1 )
 #define FORCE_SHUTDOWN_BIT ( 1 << 0 )
+#define SERVO_DONE_BIT ( 1 << 3 )
+
+#define SERVO_OPEN		1
+#define SERVO_CLOSE		0
 
 static EventGroupHandle_t xEventGroup;
+static StaticEventGroup_t xEventGroupBuf;
 static uint32_t cntrl_handle;
+static bool cntrl_open = false;
 static esp_bd_addr_t controller_mac_addr;
 
+#define LID_OPEN_ANGLE	80.0f
+#define LID_MOVE_MS		2000
+#define LID_WAIT_MS		(LID_MOVE_MS + 1000)
+
+// Runs on the servo task once a lid move completes
+static void lid_moved(void *arg){
+	if((uintptr_t)arg == SERVO_OPEN) boot_mark(BOOT_SERVO);
+	xEventGroupSetBits(xEventGroup, SERVO_DONE_BIT);
+}
+
+// A move that did not start never calls lid_moved, so its waiter is released here
+static void lid_move(float from, float to, uintptr_t dir){
+	if(!servo_motion_start(from, to, LID_MOVE_MS, lid_moved, (void*)dir)){
+		ESP_LOGE(TAG, "Lid move did not start");
+		xEventGroupSetBits(xEventGroup, SERVO_DONE_BIT);
+	}
+}
+
+static bool lid_wait(BaseType_t clear){
+	EventBits_t bits = xEventGroupWaitBits(xEventGroup, SERVO_DONE_BIT, clear, pdTRUE, pdMS_TO_TICKS(LID_WAIT_MS));
+	if(!(bits & SERVO_DONE_BIT)){
+		ESP_LOGW(TAG, "Lid move overran");
+		return false;
+	}
+	return true;
+}
+
 void sensor_task(void *arg){
 	ESP_LOGI(TAG, "Executing: %s", __func__);
-	int reading = 0, C = 0;
 	uint32_t ins = 0;
-	uint8_t lc = 0;
-	bool crg = false;
-	uint16_t curr_charge = 1023;
-	adc2_config_channel_atten(VOLTAGE_SENSOR, ADC_ATTEN_DB_11);
-	adc1_config_channel_atten(CHARGER_DETECT, ADC_ATTEN_DB_6);
-	adc1_config_width(ADC_WIDTH_BIT_9);
+	uint8_t ev;
+	TickType_t next = xTaskGetTickCount(), left;
+	battery_init();
 	while(ins != ABORT){
-		C = adc1_get_raw(CHARGER_DETECT);
-		if(!crg && C > 256){
-			crg = true;
-			curr_charge = 1023;
-			app_work_dispatch(overlay_battery_status, CRG_CONN, NULL, 0);
+		// a GOV_KICK wake only re-evaluates the governor; the battery period
+		// runs on its own schedule
+		if((int32_t)(xTaskGetTickCount() - next) >= 0){
+			next = xTaskGetTickCount() + pdMS_TO_TICKS(10000);
+			ev = battery_update();
+			if(ev & BAT_EVT_CRG_CONN) app_work_dispatch(overlay_battery_status, CRG_CONN, NULL, 0);
+			if(ev & BAT_EVT_CRG_DISCONN) app_work_dispatch(overlay_battery_status, CRG_DISCONN, NULL, 0);
+			if(ev & BAT_EVT_CRITICAL) xEventGroupSetBits(xEventGroup, FORCE_SHUTDOWN_BIT);
+			else if(ev & BAT_EVT_LOW) app_work_dispatch(overlay_battery_status, BATTERY_LOW, NULL, 0);
+			mem_sample();
+			persist_tick();
 		}
-		else if(crg && C < 256){
-			crg = false;
-			app_work_dispatch(overlay_battery_status, CRG_DISCONN, NULL, 0);
+#if CONFIG_SPECBOX_GOVERNOR
+		governor_update();
+#endif
+		left = next - xTaskGetTickCount();
+		if((int32_t)left < 0) left = 0;
+		xTaskNotifyWait(0, 0xffffffff, &ins, left);
+	}
+	sensor_handle = NULL;
+	ESP_LOGI(TAG, "Stopped %s", __func__);
+	task_exit(TASK_SENSOR);
+}
+
+// SPP command stream. Framed packets carry one or more commands:
+//   CMD_FRAME_SYNC | version | length | payload[length] | xor(payload)
+// Bytes outside a frame are taken as legacy single-byte commands. Commands with
+// an argument (VOLUME_CHANGE, LATENCY_PROFILE, SYNC_ROLE) take the following byte.
+// Frames opening with SYNC_FRAME_SYNC instead carry one sync_proto message.
+#define CMD_IDLE		0
+#define CMD_VERSION		1
+#define CMD_LENGTH		2
+#define CMD_PAYLOAD		3
+#define CMD_CHECK		4
+
+typedef struct {
+	uint8_t state;
+	uint8_t kind;
+	uint8_t version;
+	uint8_t len;
+	uint8_t pos;
+	uint8_t sum;
+	uint8_t pending;
+	uint8_t payload[CMD_FRAME_MAX];
+} cmd_parser_t;
+
+static cmd_parser_t cmd_parser;
+static bool cmd_accept = false;
+uint32_t cmd_rx_dropped = 0;
+static uint32_t cmd_bad_frames = 0;
+
+// cmd_cb_task sleeps on a queue set until data arrives, the activation window
+// timer expires or the task is asked to stop.
+static QueueSetHandle_t cmd_set;
+static xSemaphoreHandle cmd_window_sem;
+static xSemaphoreHandle cmd_abort_sem;
+static TimerHandle_t cmd_window;
+static StaticSemaphore_t cmd_window_buf, cmd_abort_buf;
+static StaticTimer_t cmd_window_timer;
+static int64_t cmd_stamp;
+cmd_stats_t cmd_stats;
+
+static bool cmd_has_arg(uint8_t command)
+{
+	return command == VOLUME_CHANGE || command == LATENCY_PROFILE || command == SYNC_ROLE;
+}
+
+// Queued behind the action on the dispatcher, so it runs once the action is done.
+static void cmd_done(uint16_t command, void *param)
+{
+	uint32_t lat = esp_timer_get_time() - *(int64_t*)param;
+
+	cmd_stats.commands += 1;
+	cmd_stats.total_us += lat;
+	if(lat > cmd_stats.max_us) cmd_stats.max_us = lat;
+	ESP_LOGI(TAG, "Command %d done in %u us (avg %u, max %u)", command, lat,
+			(uint32_t)(cmd_stats.total_us / cmd_stats.commands), cmd_stats.max_us);
+}
+
+static void cmd_window_expired(TimerHandle_t timer)
+{
+	xSemaphoreGive(cmd_window_sem);
+}
+
+void cmd_task_abort(void)
+{
+	if(cmd_abort_sem != NULL) xSemaphoreGive(cmd_abort_sem);
+}
+
+static void cmd_set_init(void)
+{
+	QueueSetMemberHandle_t m;
+
+	if(cmd_set == NULL){
+		cmd_window_sem = xSemaphoreCreateBinaryStatic(&cmd_window_buf);
+		cmd_abort_sem = xSemaphoreCreateBinaryStatic(&cmd_abort_buf);
+		cmd_window = xTimerCreateStatic("cmd_window", pdMS_TO_TICKS(CMD_WINDOW_MS), pdFALSE, NULL,
+				cmd_window_expired, &cmd_window_timer);
+		// no static variant; created once and kept
+		cmd_set = xQueueCreateSet(3);
+		xQueueAddToSet(cmd_rx_sem, cmd_set);
+		xQueueAddToSet(cmd_window_sem, cmd_set);
+		xQueueAddToSet(cmd_abort_sem, cmd_set);
+	}
+	// Drop anything left from the previous run
+	xTimerStop(cmd_window, 0);
+	while((m = xQueueSelectFromSet(cmd_set, 0)) != NULL) xSemaphoreTake(m, 0);
+	xStreamBufferReset(command_stream);
+}
+
+// Same framing as the commands, towards the controller
+bool spp_frame_send(uint8_t sync, uint8_t version, const uint8_t *payload, uint8_t len)
+{
+	uint8_t f[CMD_FRAME_MAX + 4];
+	uint8_t i, sum = 0;
+
+	if(!cntrl_open || len > CMD_FRAME_MAX) return false;
+	f[0] = sync;
+	f[1] = version;
+	f[2] = len;
+	for(i = 0; i < len; i++){
+		f[3 + i] = payload[i];
+		sum ^= payload[i];
+	}
+	f[3 + len] = sum;
+	return esp_spp_write(cntrl_handle, len + 4, f) == ESP_OK;
+}
+
+static void send_mem_report(uint16_t event, void *param)
+{
+	static char report[512];
+	int n = mem_report(report, sizeof(report));
+	const char *line, *end;
+
+	// a line per entry: the deferred log keeps only the start of a long string
+	ESP_LOGI(TAG, "Memory:");
+	for(line = report; *line != 0; line = *end ? end + 1 : end){
+		if((end = strchr(line, '\n')) == NULL) end = line + strlen(line);
+		ESP_LOGI(TAG, "  %.*s", (int)(end - line), line);
+	}
+	esp_spp_write(cntrl_handle, n, (uint8_t *)report);
+}
+
+static void cmd_execute(uint8_t command, uint8_t arg)
+{
+	ESP_LOGI(TAG, "Received: %d", command);
+	switch(command){
+	case COMMAND_MODE_ACTIVE:
+		app_work_dispatch(cmd_active, COMMAND_MODE_ACTIVE, NULL, 0);
+		cmd_accept = true;
+		xTimerReset(cmd_window, 0);
+		app_work_dispatch(cmd_done, command, &cmd_stamp, sizeof(cmd_stamp));
+		break;
+	case DEFAULT_MODE:
+	case BLUETOOTH_MODE:
+		if(cmd_accept){
+			cmd_accept = false;
+			app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
+			app_work_dispatch(set_mode, command, (void*)controller_mac_addr, ESP_BD_ADDR_LEN);
+			xTimerStop(cmd_window, 0);
+			app_work_dispatch(cmd_done, command, &cmd_stamp, sizeof(cmd_stamp));
+		}
+		break;
+	case VOLUME_CHANGE:
+		if(cmd_accept){
+			cmd_accept = false;
+			app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
+			app_work_dispatch(change_volume, arg, NULL, 0);
+			xTimerStop(cmd_window, 0);
+			app_work_dispatch(cmd_done, command, &cmd_stamp, sizeof(cmd_stamp));
+		}
+		break;
+	case LATENCY_PROFILE:
+		if(cmd_accept){
+			cmd_accept = false;
+			app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
+			app_work_dispatch(set_latency_profile, arg, NULL, 0);
+			xTimerStop(cmd_window, 0);
+			app_work_dispatch(cmd_done, command, &cmd_stamp, sizeof(cmd_stamp));
+		}
+		break;
+	case MEM_REPORT:
+		app_work_dispatch(send_mem_report, 0, NULL, 0);
+		break;
+	case SYNC_ROLE:
+		app_work_dispatch(set_sync_role, arg, NULL, 0);
+		break;
+#if CONFIG_SPECBOX_TRACE
+	case TRACE_FLUSH:
+		app_work_dispatch(trace_flush, 0, NULL, 0);
+		break;
+#endif
+	case LIGHT_ON:
+	case LIGHT_OFF:
+	case LIGHT_VU:
+		if(cmd_accept){
+			cmd_accept = false;
+			app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
+			app_work_dispatch(set_light, command, NULL, 0);
+			xTimerStop(cmd_window, 0);
+			app_work_dispatch(cmd_done, command, &cmd_stamp, sizeof(cmd_stamp));
+		}
+		break;
+	}
+}
+
+static void cmd_execute_frame(const uint8_t *payload, uint8_t len)
+{
+	uint8_t i = 0, command;
+	while(i < len){
+		command = payload[i++];
+		if(cmd_has_arg(command)){
+			if(i == len){
+				cmd_bad_frames += 1;
+				return;
+			}
+			cmd_execute(command, payload[i++]);
 		}
-		if(!crg){
-			adc2_get_raw(VOLTAGE_SENSOR, ADC_WIDTH_BIT_10, &reading);
-			if(reading < curr_charge){
-				curr_charge = reading;
+		else cmd_execute(command, 0);
+	}
+}
+
+static void cmd_parse(const uint8_t *data, size_t n)
+{
+	cmd_parser_t *p = &cmd_parser;
+	uint8_t b;
+	for(size_t i = 0; i < n; i++){
+		b = data[i];
+		switch(p->state){
+		case CMD_IDLE:
+			if(p->pending){
+				cmd_execute(p->pending, b);
+				p->pending = 0;
 			}
-			if (curr_charge <= CRITICAL_CHARGE_BOUND){
-				xEventGroupSetBits(xEventGroup, FORCE_SHUTDOWN_BIT);
+			else if(b == CMD_FRAME_SYNC || b == SYNC_FRAME_SYNC){
+				p->kind = b;
+				p->state = CMD_VERSION;
 			}
-			else if(curr_charge <= LOW_CHARGE_BOUND){
-				if(lc == 0) {
-					app_work_dispatch(overlay_battery_status, BATTERY_LOW, NULL, 0);
-					lc = 6;
-				}
-				else lc -= 1;
+			else if(cmd_has_arg(b)) p->pending = b;
+			else cmd_execute(b, 0);
+			break;
+		case CMD_VERSION:
+			p->version = b;
+			p->state = CMD_LENGTH;
+			break;
+		case CMD_LENGTH:
+			p->len = b;
+			p->pos = 0;
+			p->sum = 0;
+			p->state = b == 0 ? CMD_CHECK : CMD_PAYLOAD;
+			if(b > CMD_FRAME_MAX){
+				cmd_bad_frames += 1;
+				p->state = CMD_IDLE;
+			}
+			break;
+		case CMD_PAYLOAD:
+			p->payload[p->pos++] = b;
+			p->sum ^= b;
+			if(p->pos == p->len) p->state = CMD_CHECK;
+			break;
+		case CMD_CHECK:
+			p->state = CMD_IDLE;
+			if(b != p->sum || p->version != (p->kind == SYNC_FRAME_SYNC ? SYNC_PROTO_VERSION : CMD_PROTO_VERSION)){
+				cmd_bad_frames += 1;
+				ESP_LOGW(TAG, "Dropped command frame v%d (%d bad)", p->version, cmd_bad_frames);
+				break;
 			}
+			// stamped with the arrival of the burst, for the clock estimate
+			if(p->kind == SYNC_FRAME_SYNC) sync_link_rx(p->payload, p->len, cmd_stamp);
+			else cmd_execute_frame(p->payload, p->len);
+			break;
 		}
-		xTaskNotifyWait(0, 0xffffffff, &ins, pdMS_TO_TICKS(10000));
 	}
-	sensor_handle = NULL;
-	ESP_LOGI(TAG, "Stopped %s", __func__);
-	vTaskDelete(NULL);
 }
 
 void cmd_cb_task(void *arg){
 	ESP_LOGI(TAG, "Executing: %s", __func__);
-	uint8_t command = 0;
-	uint32_t ins = 0;
-	bool cmd_accept = false;
-	uint8_t active_count = 0, level = 5;
-	while(ins != ABORT){
-		if(xQueueReceive(command_queue, &command, 0) == pdTRUE){
-			ESP_LOGI(TAG, "Received: %d", command);
-			switch(command){
-			case COMMAND_MODE_ACTIVE:
-				app_work_dispatch(cmd_active, COMMAND_MODE_ACTIVE, NULL, 0);
-				cmd_accept = true;
-				active_count = 15;
-				break;
-			case DEFAULT_MODE:
-			case BLUETOOTH_MODE:
-				if(cmd_accept){
-					cmd_accept = false;
-					app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
-					app_work_dispatch(set_mode, command, (void*)controller_mac_addr, ESP_BD_ADDR_LEN);
-					active_count = 0;
-				}
-				break;
-			case VOLUME_CHANGE:
-				if(cmd_accept){
-					cmd_accept = false;
-					app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
-					xQueueReceive(command_queue, &level, portMAX_DELAY);
-					app_work_dispatch(change_volume, level, NULL, 0);
-					active_count = 0;
-				}
-				break;
-			case LIGHT_ON:
-			case LIGHT_OFF:
-				if(cmd_accept){
-					cmd_accept = false;
-					app_work_dispatch(cmd_active, COMMAND_MODE_ACCEPTED, NULL, 0);
-					app_work_dispatch(set_light, command, NULL, 0);
-					active_count = 0;
-				}
-				break;
+	uint8_t burst[CMD_FRAME_MAX];
+	size_t n;
+	QueueSetMemberHandle_t ev = NULL;
+	memset(&cmd_parser, 0, sizeof(cmd_parser));
+	cmd_accept = false;
+	cmd_set_init();
+	while(ev != cmd_abort_sem){
+		ev = xQueueSelectFromSet(cmd_set, portMAX_DELAY);
+		if(ev == NULL || xSemaphoreTake(ev, 0) != pdTRUE) continue;
+		if(ev == cmd_rx_sem){
+			cmd_stamp = get_cmd_rx_stamp();
+			while((n = xStreamBufferReceive(command_stream, burst, sizeof(burst), 0)) > 0){
+				cmd_parse(burst, n);
 			}
 		}
-
-		if(active_count > 0){
-			active_count -= 1;
-		}
-		else if(cmd_accept){
+		else if(ev == cmd_window_sem && cmd_accept){
 			cmd_accept = false;
 			app_work_dispatch(cmd_active, COMMAND_MODE_INACTIVE, NULL, 0);
 		}
-		xTaskNotifyWait(0, 0xffffffff, &ins, pdMS_TO_TICKS(1000));
 	}
+	xTimerStop(cmd_window, 0);
 	command_handle = NULL;
 	ESP_LOGI(TAG, "Stopped %s", __func__);
-	vTaskDelete(NULL);
+	task_exit(TASK_CMD);
 }
 
 
@@ -152,6 +394,9 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
         break;
     case ESP_SPP_CLOSE_EVT:
     	ESP_LOGI(TAG, "ESP_SPP_CLOSE_EVT");
+    	cntrl_open = false;
+    	// not here: sync_lock can be held by a task waiting on this one
+    	app_work_dispatch(set_sync_role, SYNC_ROLE_OFF, NULL, 0);
     	xEventGroupSetBits(xEventGroup, SLEEP_BIT);
     	esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
         break;
@@ -160,12 +405,11 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
         esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
         break;
     case ESP_SPP_DATA_IND_EVT:
-    	for(int i = 0; i < param->data_ind.len; i++){
-    		xQueueSend(command_queue, param->data_ind.data + i, portMAX_DELAY);
-    	}
+    	cmd_rx(param->data_ind.data, param->data_ind.len);
         break;
     case ESP_SPP_SRV_OPEN_EVT:
     	cntrl_handle = param->srv_open.handle;
+    	cntrl_open = true;
     	memcpy(controller_mac_addr, param->srv_open.rem_bda, ESP_BD_ADDR_LEN);
     	xEventGroupSetBits(xEventGroup, WAKEUP_BIT);
     	esp_bt_gap_set_scan_mode(ESP_BT_NON_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
@@ -233,7 +477,11 @@ void app_main(void)
 {
 	/////////////////////////////////////////////////////////////////////////////////////////////
 
+#if CONFIG_SPECBOX_LOG_DEFER
+	log_defer_init();
+#endif
 	nvs_flash_init();
+	persist_init();
 	init_ext_storage();
 
 	esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT(); // @suppress("Symbol is not resolved")
@@ -258,48 +506,47 @@ void app_main(void)
 	esp_a2d_register_callback(&bt_app_a2d_cb);
 	esp_a2d_sink_register_data_callback(bt_app_a2d_data_cb);
 
+	sync_link_init();
 	esp_spp_register_callback(esp_spp_cb);
 	esp_spp_init(ESP_SPP_MODE_CB);
 
 	////////////////////////////////////////////////////////////////////////////////////////////////
 
-	servo_config_t servo_cfg = {
-		.max_angle = 180,
-		.min_width_us = 500,
-		.max_width_us = 2500,
-		.freq = 50,
-		.timer_number = LEDC_TIMER_0,
-		.channels = {
-			.servo_pin = { SERVO_1, SERVO_2, SERVO_3, SERVO_4 },
-			.ch = { LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3 },
-		},
-		.channel_number = 4,
-	} ;
-	xEventGroup = xEventGroupCreate();
+	xEventGroup = xEventGroupCreateStatic(&xEventGroupBuf);
+#if CONFIG_SPECBOX_SOAK_CYCLES > 0
+	soak_run(CONFIG_SPECBOX_SOAK_CYCLES);
+#endif
 	bool bcsn = false;
+	int64_t t0, t1, t2;
 	EventBits_t uxBits;
+	bool lid_ok;
 	while(true){
 		uxBits = xEventGroupWaitBits(xEventGroup,
 				SLEEP_BIT | WAKEUP_BIT | FORCE_SHUTDOWN_BIT,
 				pdTRUE, pdFALSE, portMAX_DELAY);
 		if( (uxBits & WAKEUP_BIT) )
 		{
+			// Servos, analyzer/LED bring-up and the clip prefetch run side by side;
+			// the greeting starts as soon as its head is in memory.
+			boot_begin();
+#if CONFIG_SPECBOX_GOVERNOR
+			governor_wake();
+#endif
 			app_task_start_up();
 			i2s_task_start_up();
+			xEventGroupClearBits(xEventGroup, SERVO_DONE_BIT);
+			servo_motion_init(0.0f);
+			lid_move(0.0f, LID_OPEN_ANGLE, SERVO_OPEN);
+			app_work_dispatch(cmpl_tasks_start_up, 0, NULL, 0);
+			boot_mark(BOOT_TASKS);
 
-			iot_servo_init(LEDC_LOW_SPEED_MODE, &servo_cfg);
-			for(float i = 0; i <= 80.0f; i++){
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_3, i);
-				vTaskDelay(25 / portTICK_PERIOD_MS);
-			}
-
-			vTaskDelay(500 / portTICK_PERIOD_MS);
-			xTaskNotify(s_i2s_task_handle, 5, eSetValueWithOverwrite);
+			narrate_prefetch();
+			boot_mark(BOOT_PREFETCH);
+			xTaskNotify(s_i2s_task_handle, persist.volume, eSetValueWithOverwrite);
 			app_work_dispatch(indirect_narrate, GM_NARRATE_EVENT, NULL, 0);
-			app_work_dispatch(cmpl_tasks_start_up, 0, NULL, 0);
+			if(persist.mode != NO_MODE){
+				app_work_dispatch(set_mode, persist.mode, (void*)controller_mac_addr, ESP_BD_ADDR_LEN);
+			}
 		}
 		else if( (uxBits & FORCE_SHUTDOWN_BIT) )
 		{
@@ -310,6 +557,7 @@ void app_main(void)
 		}
 		else if( (uxBits & SLEEP_BIT) )
 		{
+			t0 = esp_timer_get_time();
 			app_work_dispatch(set_mode, NO_MODE, (void*)controller_mac_addr, ESP_BD_ADDR_LEN);
 			if(!bcsn){
 				app_work_dispatch(indirect_narrate, GN_NARRATE_EVENT, NULL, 0);
@@ -317,23 +565,31 @@ void app_main(void)
 
 			app_work_dispatch(cmpl_tasks_shut_down, 0, NULL, 0);
 
-			for(float i = 80.0f; i >= 0.0f; i--){
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, i);
-				iot_servo_write_angle(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_3, i);
-				vTaskDelay(25 / portTICK_PERIOD_MS);
-			}
-
-			vTaskDelay(500 / portTICK_PERIOD_MS);
-			iot_servo_deinit(LEDC_LOW_SPEED_MODE);
-
-			app_msg_t msg;
-			while(xQueuePeek(s_app_task_queue, &msg, pdMS_TO_TICKS(100)) == pdTRUE) vTaskDelay(pdMS_TO_TICKS(500));
-
-			vTaskDelay(2000 / portTICK_PERIOD_MS);
+			// an opening move may still be running; the close runs while the
+			// dispatcher drains
+			lid_ok = lid_wait(pdTRUE);
+			if(lid_ok) lid_move(LID_OPEN_ANGLE, 0.0f, SERVO_CLOSE);
+
+			if(!app_work_drain(SHUTDOWN_TIMEOUT_MS)) ESP_LOGW(TAG, "Dispatcher did not drain");
+			if(!mode_wait_idle(3 * MODE_STEP_TIMEOUT_MS)) ESP_LOGW(TAG, "Mode switch did not settle");
+			t1 = esp_timer_get_time();
+			cmpl_tasks_join(SHUTDOWN_TIMEOUT_MS);
+			t2 = esp_timer_get_time();
+			persist_save();
+#if CONFIG_SPECBOX_TRACE
+			trace_flush(0, NULL);
+#endif
+
+			// a move still running keeps LEDC until the next wake
+			if(lid_ok && lid_wait(pdFALSE)) servo_motion_deinit();
 			i2s_task_shut_down();
 			app_task_shut_down();
+#if CONFIG_SPECBOX_GOVERNOR
+			governor_sleep();
+#endif
+			ESP_LOGI(TAG, "Shutdown: dispatcher %u ms, workers %u ms, total %u ms",
+					(uint32_t)((t1 - t0) / 1000), (uint32_t)((t2 - t1) / 1000),
+					(uint32_t)((esp_timer_get_time() - t0) / 1000));
 		}
 	}
 
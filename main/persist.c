@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#define TAG "PERSIST"
+
+// Warm-start state kept in one NVS blob: the light normalization and color
+// cycle, volume and the last mode picked. Changes only mark the RAM copy dirty;
+// it reaches flash from sensor_task at most every CONFIG_SPECBOX_PERSIST_PERIOD_S
+// and once on sleep, and only when it differs from what was last written. NVS
+// appends each write to its pages, so fewer, whole-blob writes is what spares
+// the flash. A wake restores from RAM; NVS is read once at boot.
+#define PERSIST_NS					"specbox"
+#define PERSIST_KEY					"warm"
+#define PERSIST_VERSION				1
+
+typedef struct {
+	uint8_t version;
+	uint8_t volume;
+	uint16_t mode;
+	uint8_t light_valid;
+	light_state_t light;
+} persist_blob_t;
+
+persist_t persist = { .volume = PERSIST_DEFAULT_VOLUME, .mode = NO_MODE };
+
+static portMUX_TYPE persist_mux = portMUX_INITIALIZER_UNLOCKED;
+static light_state_t light;
+static bool light_valid = false;
+static bool dirty = false;
+static persist_blob_t written;
+static int64_t last_save = 0;
+
+static bool light_sane(const light_state_t *ls)
+{
+	int i;
+
+	for(i = 0; i < HN_LED; i++){
+		if(!isfinite(ls->max[i]) || !isfinite(ls->min[i]) || !isfinite(ls->cs[i]) || !isfinite(ls->rate[i])) return false;
+		if(ls->min[i] > ls->max[i]) return false;
+	}
+	return ls->lci < 3 && ls->hci < 3;
+}
+
+void persist_init(void)
+{
+	nvs_handle_t h;
+	persist_blob_t b;
+	size_t len = sizeof(b);
+
+	if(nvs_open(PERSIST_NS, NVS_READONLY, &h) != ESP_OK) return;
+	if(nvs_get_blob(h, PERSIST_KEY, &b, &len) == ESP_OK && len == sizeof(b) && b.version == PERSIST_VERSION){
+		written = b;
+		if(b.volume <= 10) persist.volume = b.volume;
+		if(b.mode == DEFAULT_MODE || b.mode == BLUETOOTH_MODE) persist.mode = b.mode;
+		if(b.light_valid && light_sane(&b.light)){
+			light = b.light;
+			light_valid = true;
+		}
+		ESP_LOGI(TAG, "Restored: volume %u, mode %u, light %s", persist.volume, persist.mode,
+				light_valid ? "calibrated" : "cold");
+	}
+	nvs_close(h);
+}
+
+bool persist_light_get(light_state_t *ls)
+{
+	bool valid;
+
+	portENTER_CRITICAL(&persist_mux);
+	valid = light_valid;
+	if(valid) *ls = light;
+	portEXIT_CRITICAL(&persist_mux);
+	return valid;
+}
+
+void persist_light_put(const light_state_t *ls)
+{
+	portENTER_CRITICAL(&persist_mux);
+	light = *ls;
+	light_valid = true;
+	dirty = true;
+	portEXIT_CRITICAL(&persist_mux);
+}
+
+void persist_set_volume(uint8_t volume)
+{
+	portENTER_CRITICAL(&persist_mux);
+	if(persist.volume != volume){
+		persist.volume = volume;
+		dirty = true;
+	}
+	portEXIT_CRITICAL(&persist_mux);
+}
+
+void persist_set_mode(uint16_t mode)
+{
+	portENTER_CRITICAL(&persist_mux);
+	if(persist.mode != mode){
+		persist.mode = mode;
+		dirty = true;
+	}
+	portEXIT_CRITICAL(&persist_mux);
+}
+
+void persist_save(void)
+{
+	nvs_handle_t h;
+	persist_blob_t b;
+	esp_err_t err;
+
+	if(!dirty) return;
+	memset(&b, 0, sizeof(b));
+	b.version = PERSIST_VERSION;
+	portENTER_CRITICAL(&persist_mux);
+	b.volume = persist.volume;
+	b.mode = persist.mode;
+	b.light_valid = light_valid;
+	b.light = light;
+	dirty = false;
+	portEXIT_CRITICAL(&persist_mux);
+	last_save = esp_timer_get_time();
+	if(memcmp(&b, &written, sizeof(b)) == 0) return;
+
+	err = nvs_open(PERSIST_NS, NVS_READWRITE, &h);
+	if(err == ESP_OK){
+		err = nvs_set_blob(h, PERSIST_KEY, &b, sizeof(b));
+		if(err == ESP_OK) err = nvs_commit(h);
+		nvs_close(h);
+	}
+	if(err != ESP_OK){
+		ESP_LOGW(TAG, "Save failed: %s", esp_err_to_name(err));
+		// retried on the next period
+		dirty = true;
+		return;
+	}
+	written = b;
+	persist.writes += 1;
+	ESP_LOGI(TAG, "Saved (%u writes)", persist.writes);
+}
+
+// From sensor_task's period
+void persist_tick(void)
+{
+	if(dirty && esp_timer_get_time() - last_save >= CONFIG_SPECBOX_PERSIST_PERIOD_S * 1000000LL) persist_save();
+}
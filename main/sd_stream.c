@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "app_core.h"
+#include "sd_stream.h"
+#include "sdmmc_cmd.h"
+#include "driver/sdspi_host.h"
+#include "diskio_sdmmc.h"
+#include "ff.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "SD_STREAM"
+
+#define SD_SECTOR					512
+
+#if FF_MAX_SS == FF_MIN_SS
+#define FS_SECTOR(fs)				FF_MAX_SS
+#else
+#define FS_SECTOR(fs)				((fs)->ssize)
+#endif
+
+#if SD_STREAM_BYTES < 2 * CSIZE
+#error "stream buffer smaller than two blocks"
+#endif
+
+static sdmmc_card_t *sd_card = NULL;
+static xSemaphoreHandle card_lock = NULL;
+static StaticSemaphore_t card_lock_buf;
+// SDSPI reads by DMA into internal RAM; anything else goes through a bounce
+// buffer one sector at a time
+static DMA_ATTR uint8_t stream_buf[SD_STREAM_BYTES];
+
+void sd_stream_init(sdmmc_card_t *card)
+{
+	if(card_lock == NULL) card_lock = xSemaphoreCreateMutexStatic(&card_lock_buf);
+	sd_card = card;
+}
+
+// Without a mounted card there is nothing to serialise
+void sd_lock(void)
+{
+	if(card_lock != NULL) xSemaphoreTake(card_lock, portMAX_DELAY);
+}
+
+void sd_unlock(void)
+{
+	if(card_lock != NULL) xSemaphoreGive(card_lock);
+}
+
+// First sector of the file when its clusters follow each other, else 0. The
+// walk seeks a cluster at a time, which FatFs follows from the current
+// cluster, so it reads each FAT sector of the chain once.
+static uint32_t first_sector(const char *path, uint32_t *size)
+{
+	const char *rel = strchr(path + 1, '/');
+	char fpath[32];
+	FIL fil;
+	FATFS *fs;
+	FSIZE_t ofs, bcs;
+	DWORD start, clust;
+	uint32_t sector = 0;
+
+	if(sd_card == NULL || rel == NULL) return 0;
+	snprintf(fpath, sizeof(fpath), "%u:%s", ff_diskio_get_pdrv_card(sd_card), rel);
+	if(f_open(&fil, fpath, FA_READ) != FR_OK) return 0;
+	fs = fil.obj.fs;
+	bcs = (FSIZE_t)fs->csize * FS_SECTOR(fs);
+	start = clust = fil.obj.sclust;
+	*size = f_size(&fil);
+	if(FS_SECTOR(fs) != SD_SECTOR || sd_card->csd.sector_size != SD_SECTOR || start < 2){
+		f_close(&fil);
+		return 0;
+	}
+	for(ofs = bcs; ofs < *size; ofs += bcs){
+		// fil.clust holds the byte before the file pointer
+		if(f_lseek(&fil, ofs + 1) != FR_OK) break;
+		if(fil.clust != ++clust){
+			ESP_LOGW(TAG, "%s: fragmented after %u KB", path, (uint32_t)(ofs / 1024));
+			break;
+		}
+	}
+	if(ofs >= *size) sector = fs->database + (start - 2) * fs->csize;
+	f_close(&fil);
+	return sector;
+}
+
+bool sd_stream_open(sd_stream_t *s, const char *path)
+{
+	memset(s, 0, sizeof(*s));
+	sd_lock();
+	s->sector = first_sector(path, &s->size);
+	if(s->sector == 0 && (s->f = fopen(path, "r")) != NULL){
+		fseek(s->f, 0, SEEK_END);
+		s->size = ftell(s->f);
+	}
+	sd_unlock();
+	if(s->sector != 0){
+		ESP_LOGI(TAG, "%s: contiguous from sector %u, %u KB reads", path, s->sector, CONFIG_SPECBOX_SD_STREAM_KB);
+	}
+	else if(s->f != NULL) ESP_LOGI(TAG, "%s: reading through stdio", path);
+	else return false;
+	return true;
+}
+
+// len bytes at pos, at most SD_STREAM_BYTES - SD_SECTOR. NULL past the end or
+// on a read error.
+const uint8_t *sd_stream_read(sd_stream_t *s, uint32_t pos, size_t len)
+{
+	uint32_t first, n;
+	bool ok;
+
+	if(len > SD_STREAM_BYTES - SD_SECTOR || pos + len > s->size) return NULL;
+	if(pos >= s->buf_pos && pos + len <= s->buf_pos + s->buf_len) return stream_buf + (pos - s->buf_pos);
+
+	s->buf_len = 0;
+	if(s->sector != 0){
+		// from the sector holding pos, as many as the buffer takes
+		first = pos / SD_SECTOR;
+		n = (s->size + SD_SECTOR - 1) / SD_SECTOR - first;
+		if(n > SD_STREAM_BYTES / SD_SECTOR) n = SD_STREAM_BYTES / SD_SECTOR;
+		sd_lock();
+		ok = sdmmc_read_sectors(sd_card, stream_buf, s->sector + first, n) == ESP_OK;
+		sd_unlock();
+		if(!ok){
+			ESP_LOGE(TAG, "Read of %u sectors at %u failed", n, s->sector + first);
+			return NULL;
+		}
+		s->buf_pos = first * SD_SECTOR;
+		n *= SD_SECTOR;
+	}
+	else{
+		n = s->size - pos < SD_STREAM_BYTES ? s->size - pos : SD_STREAM_BYTES;
+		sd_lock();
+		ok = fseek(s->f, pos, SEEK_SET) == 0 && fread(stream_buf, 1, n, s->f) == n;
+		sd_unlock();
+		if(!ok) return NULL;
+		s->buf_pos = pos;
+	}
+	s->buf_len = s->size - s->buf_pos < n ? s->size - s->buf_pos : n;
+	return stream_buf + (pos - s->buf_pos);
+}
+
+void sd_stream_close(sd_stream_t *s)
+{
+	if(s->f != NULL){
+		sd_lock();
+		fclose(s->f);
+		sd_unlock();
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+#if CONFIG_SPECBOX_SD_BENCH
+// Reads the same stretch of a file block by block, as play_default does, from
+// just past the WAV header: through stdio as before, through stdio with a
+// buffer the size of the stream's, and as multi-block reads at the configured
+// SPI clock and at 40 MHz. Cards that did not switch to high speed when
+// mounted may fail the last.
+#define SD_BENCH_BYTES				(1024 * 1024)
+#define SD_BENCH_OFFSET				44
+
+static void bench_log(const char *what, int64_t us, uint32_t bytes)
+{
+	if(us <= 0){
+		ESP_LOGW(TAG, "%-26s failed", what);
+		return;
+	}
+	ESP_LOGI(TAG, "%-26s %5u KB/s, %5u us per block", what, (uint32_t)(bytes * 1000000LL / 1024 / us),
+			(uint32_t)(us * CSIZE / bytes));
+}
+
+static int64_t bench_stdio(const char *path, size_t vbuf, uint32_t bytes)
+{
+	FILE *f;
+	int64_t t0, t = 0;
+	uint32_t pos;
+
+	sd_lock();
+	if((f = fopen(path, "r")) == NULL){
+		sd_unlock();
+		return 0;
+	}
+	if(vbuf > 0) setvbuf(f, NULL, _IOFBF, vbuf);
+	t0 = esp_timer_get_time();
+	fseek(f, SD_BENCH_OFFSET, SEEK_SET);
+	for(pos = 0; pos < bytes; pos += CSIZE){
+		if(fread(stream_buf, 1, CSIZE, f) != CSIZE) break;
+	}
+	if(pos >= bytes) t = esp_timer_get_time() - t0;
+	fclose(f);
+	sd_unlock();
+	return t;
+}
+
+static int64_t bench_stream(sd_stream_t *s, uint32_t bytes)
+{
+	int64_t t0 = esp_timer_get_time();
+	uint32_t pos;
+
+	s->buf_len = 0;
+	for(pos = 0; pos < bytes; pos += CSIZE){
+		if(sd_stream_read(s, SD_BENCH_OFFSET + pos, CSIZE) == NULL) return 0;
+	}
+	return esp_timer_get_time() - t0;
+}
+
+void sd_stream_bench(const char *path)
+{
+	sd_stream_t s;
+	uint32_t bytes;
+	char what[32];
+
+	if(sd_card == NULL || !sd_stream_open(&s, path)) return;
+	bytes = s.size > SD_BENCH_OFFSET ? (s.size - SD_BENCH_OFFSET) / CSIZE * CSIZE : 0;
+	if(bytes > SD_BENCH_BYTES) bytes = SD_BENCH_BYTES;
+	if(bytes == 0){
+		sd_stream_close(&s);
+		return;
+	}
+	ESP_LOGI(TAG, "Bench: %u KB of %s in %u B blocks, SPI clock %u kHz", bytes / 1024, path, CSIZE,
+			sd_card->max_freq_khz);
+	bench_log("stdio", bench_stdio(path, 0, bytes), bytes);
+	snprintf(what, sizeof(what), "stdio, %u KB buffer", CONFIG_SPECBOX_SD_STREAM_KB);
+	bench_log(what, bench_stdio(path, SD_STREAM_BYTES, bytes), bytes);
+	if(s.sector == 0){
+		ESP_LOGW(TAG, "Bench: %s is fragmented, no multi-block reads", path);
+		sd_stream_close(&s);
+		return;
+	}
+	snprintf(what, sizeof(what), "multi-block, %u KB", CONFIG_SPECBOX_SD_STREAM_KB);
+	bench_log(what, bench_stream(&s, bytes), bytes);
+	if(sd_card->max_freq_khz < SDMMC_FREQ_HIGHSPEED &&
+			sdspi_host_set_card_clk(sd_card->host.slot, SDMMC_FREQ_HIGHSPEED) == ESP_OK){
+		bench_log("multi-block, 40 MHz", bench_stream(&s, bytes), bytes);
+		bench_log("stdio, 40 MHz", bench_stdio(path, 0, bytes), bytes);
+		sdspi_host_set_card_clk(sd_card->host.slot, sd_card->max_freq_khz);
+	}
+	sd_stream_close(&s);
+}
+#endif
@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "driver/ledc.h"
+#include "esp_log.h"
+
+#define TAG "SERVO"
+
+// Lid servos driven straight from LEDC. A move is split into segments along a
+// smoothstep curve; the fade hardware ramps the duty within each segment, so
+// all four channels move together with no per-step work on the CPU.
+#define SERVO_MODE					LEDC_LOW_SPEED_MODE
+#define SERVO_TIMER					LEDC_TIMER_0
+#define SERVO_FREQ					50
+#define SERVO_PERIOD_US				(1000000 / SERVO_FREQ)
+#define SERVO_MIN_US				500
+#define SERVO_MAX_US				2500
+#define SERVO_MAX_ANGLE				180.0f
+#define SERVO_SEGMENTS				8
+#define SERVO_COUNT					4
+
+static const uint8_t servo_pins[SERVO_COUNT] = { SERVO_1, SERVO_2, SERVO_3, SERVO_4 };
+static const ledc_channel_t servo_ch[SERVO_COUNT] = { LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3 };
+
+typedef struct {
+	float from;
+	float to;
+	uint32_t duration_ms;
+	servo_done_cb_t cb;
+	void *arg;
+} servo_move_t;
+
+static servo_move_t servo_move;
+static bool servo_ready = false;
+
+static uint32_t servo_duty(float angle)
+{
+	float us = SERVO_MIN_US + (SERVO_MAX_US - SERVO_MIN_US) * angle / SERVO_MAX_ANGLE;
+	return (uint32_t)(us * ((1 << LEDC_TIMER_16_BIT) - 1) / SERVO_PERIOD_US);
+}
+
+// smoothstep: zero velocity at both ends of the move
+static float servo_ease(float t)
+{
+	return t * t * (3.0f - 2.0f * t);
+}
+
+void servo_motion_init(float angle)
+{
+	int i;
+	ledc_timer_config_t timer = {
+		.speed_mode = SERVO_MODE,
+		.duty_resolution = LEDC_TIMER_16_BIT,
+		.timer_num = SERVO_TIMER,
+		.freq_hz = SERVO_FREQ,
+		.clk_cfg = LEDC_AUTO_CLK,
+	};
+	ledc_channel_config_t ch = {
+		.speed_mode = SERVO_MODE,
+		.intr_type = LEDC_INTR_DISABLE,
+		.timer_sel = SERVO_TIMER,
+		.duty = servo_duty(angle),
+		.hpoint = 0,
+	};
+
+	if(servo_ready) return;
+	ledc_timer_config(&timer);
+	for(i = 0; i < SERVO_COUNT; i++){
+		ch.gpio_num = servo_pins[i];
+		ch.channel = servo_ch[i];
+		ledc_channel_config(&ch);
+	}
+	ledc_fade_func_install(0);
+	servo_ready = true;
+}
+
+void servo_motion_deinit(void)
+{
+	int i;
+
+	if(!servo_ready) return;
+	for(i = 0; i < SERVO_COUNT; i++) ledc_stop(SERVO_MODE, servo_ch[i], 0);
+	ledc_fade_func_uninstall();
+	servo_ready = false;
+}
+
+void servo_task(void *arg)
+{
+	servo_move_t *m = (servo_move_t *)arg;
+	uint32_t seg_ms = m->duration_ms / SERVO_SEGMENTS, duty;
+	int i, k;
+
+	for(k = 1; k <= SERVO_SEGMENTS; k++){
+		duty = servo_duty(m->from + (m->to - m->from) * servo_ease((float)k / SERVO_SEGMENTS));
+		for(i = 0; i < SERVO_COUNT; i++){
+			ledc_set_fade_with_time(SERVO_MODE, servo_ch[i], duty, seg_ms);
+		}
+		for(i = 0; i < SERVO_COUNT; i++){
+			ledc_fade_start(SERVO_MODE, servo_ch[i], i == SERVO_COUNT - 1 ? LEDC_FADE_WAIT_DONE : LEDC_FADE_NO_WAIT);
+		}
+	}
+	ESP_LOGI(TAG, "Moved %d -> %d in %u ms", (int)m->from, (int)m->to, m->duration_ms);
+	servo_handle = NULL;
+	if(m->cb != NULL) m->cb(m->arg);
+	task_exit(TASK_SERVO);
+}
+
+bool servo_motion_start(float from, float to, uint32_t duration_ms, servo_done_cb_t cb, void *arg)
+{
+	if(!servo_ready || servo_handle != NULL) return false;
+	servo_move.from = from;
+	servo_move.to = to;
+	servo_move.duration_ms = duration_ms;
+	servo_move.cb = cb;
+	servo_move.arg = arg;
+	start_task(TASK_SERVO, &servo_move, &servo_handle);
+	return servo_handle != NULL;
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -15,11 +16,19 @@
 #include "led_strip.h"
 #include "esp_dsp.h"
 #include "driver/rmt.h"
+#include "esp_timer.h"
+#include "freertos/timers.h"
+#include "freertos/event_groups.h"
+#include "app_av.h"
+#include "sync_proto.h"
+#include "sd_stream.h"
+#include <sys/stat.h>
 
 #define TAG "SPEC_OPS"
 #define MOUNT_POINT "/sdcard"
 
 #define MONOMAN						MOUNT_POINT"/monoman.wav"
+#define MONOMAN_TRACK				MOUNT_POINT"/monoman.lgt"
 #define GOODMORNING 				MOUNT_POINT"/gm.wav"
 #define GOODNIGHT 					MOUNT_POINT"/gn.wav"
 #define SWITCH_DEFAULT 				MOUNT_POINT"/def.wav"
@@ -38,6 +47,42 @@ static const uint8_t BT_VOL = 5;
 bool OVL_STATE = false;
 static uint8_t narrate_data[CSIZE];
 
+// Head of the wake-up clip, read while the servos move so narration can start
+// before the file is reopened.
+#define PREFETCH_BYTES				(2 * CSIZE)
+static uint8_t gm_head[PREFETCH_BYTES];
+static size_t gm_head_len = 0;
+static const char* const prompt_clips[] = {
+	CMD_YES_SOUND, CMD_ICGI_SOUND, CMD_GOTIT_SOUND, SWITCH_DEFAULT, SWITCH_BT
+};
+
+#define TRACK_MAGIC					"LTRK"
+#define TRACK_VERSION				1
+#define WAV_HEADER_SIZE				44
+
+typedef struct __attribute__((packed)) {
+	char magic[4];
+	uint8_t version;
+	uint8_t n_bands;
+	uint8_t scale;
+	uint8_t reserved;
+	uint32_t hop_bytes;
+	uint32_t data_offset;			// informational: frames follow play_default's blocks
+	uint32_t n_frames;
+} track_header_t;
+
+static uint8_t track_scale = 8;
+
+// Light pipeline working set, kept off the color task's stack. The magnitude
+// spectrum is written over the FFT input once the transform is done.
+typedef struct {
+	float fft_table[CHUNK_SIZE];
+	float data[2 * CHUNK_SIZE];
+} dsp_work_t;
+
+static dsp_work_t dsp_work __attribute__((aligned(16)));
+const size_t dsp_work_size = sizeof(dsp_work_t);
+
 void init_ext_storage()
 {
 	esp_err_t ret;
@@ -45,6 +90,7 @@ void init_ext_storage()
 
 	sdmmc_card_t *card;
 	sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+	host.max_freq_khz = CONFIG_SPECBOX_SD_FREQ_KHZ;
 
 	esp_vfs_fat_sdmmc_mount_config_t mount_config = {
 		.format_if_mount_failed = false,
@@ -87,62 +133,151 @@ void init_ext_storage()
 		return;
 	}
 	ESP_LOGI(TAG, "File system mounted");
+	sd_stream_init(card);
+#if CONFIG_SPECBOX_SD_BENCH
+	sd_stream_bench(MONOMAN);
+#endif
+}
+
+void narrate_prefetch(void)
+{
+	struct stat st;
+	FILE* f;
+	int i;
+
+	gm_head_len = 0;
+	sd_lock();
+	if((f = fopen(GOODMORNING, "r")) != NULL){
+		fseek(f, WAV_HEADER_SIZE, SEEK_SET);
+		gm_head_len = fread(gm_head, 1, PREFETCH_BYTES, f) & ~3;
+		fclose(f);
+	}
+	// warms the FAT directory cache for the first command prompts
+	for(i = 0; i < sizeof(prompt_clips) / sizeof(prompt_clips[0]); i++){
+		if(stat(prompt_clips[i], &st) != 0) ESP_LOGW(TAG, "Missing prompt: %s", prompt_clips[i]);
+	}
+	sd_unlock();
 }
 
 static void narrate(const char* file)
 {
+	bool head = gm_head_len > 0 && strcmp(file, GOODMORNING) == 0;
+	uint32_t s_rate;
+	size_t sent = 0, n;
+
 	STL_STATE = true;
 	vTaskDelay(200 / portTICK_PERIOD_MS);
 	i2s_zero_dma_buffer(i2s_out_num);
 
+	if(head){
+		s_rate = i2s_get_clk(i2s_out_num);
+		if(s_rate != 44100) i2s_set_clk(i2s_out_num, 44100, 16, 2);
+		// in blocks, as the file follows; what did not go out is read again
+		for(; sent < gm_head_len; sent += n){
+			n = gm_head_len - sent > CSIZE ? CSIZE : gm_head_len - sent;
+			if(!write_ringbuf_narrate(gm_head + sent, n)){
+				ESP_LOGE(TAG, "Greeting head stopped at %zu bytes", sent);
+				break;
+			}
+		}
+	}
+
+	sd_lock();
 	FILE* f = fopen(file, "r");
 	if(f == NULL){
+		sd_unlock();
 		ESP_LOGE(TAG, "Can't open: %s", file);
+		STL_STATE = false;
 		return;
 	}
 	fseek(f, 0, SEEK_END);
 	size_t size = ftell(f);
-	rewind(f);
+	sd_unlock();
 	uint32_t chunk = 0;
-	size_t pos;
+	size_t pos = WAV_HEADER_SIZE;
 
-	uint32_t s_rate = i2s_get_clk(i2s_out_num);
-	if(s_rate != 44100){
-		i2s_set_clk(i2s_out_num, 44100, 16, 2);
+	if(head){
+		pos += sent;
+		gm_head_len = 0;
+	}
+	else{
+		s_rate = i2s_get_clk(i2s_out_num);
+		if(s_rate != 44100){
+			i2s_set_clk(i2s_out_num, 44100, 16, 2);
+		}
 	}
-	fseek(f, 44, SEEK_SET);
-	pos = 44;
+	sd_lock();
+	fseek(f, pos, SEEK_SET);
+	sd_unlock();
 	while(pos < size)
 	{
 		chunk = (size - pos) > CSIZE ? CSIZE : (size - pos);
+		// the ring send blocks, so the card is only held for the read
+		sd_lock();
 		fread(narrate_data, 1, chunk, f);
-		xRingbufferSend(audio_channel, (void *)narrate_data, chunk, (portTickType)portMAX_DELAY);
+		sd_unlock();
+		if(!write_ringbuf_narrate(narrate_data, chunk)){
+			ESP_LOGE(TAG, "Can't queue %s at %zu", file, pos);
+			break;
+		}
 		pos += chunk;
 	}
 	if(s_rate != 44100){
 		i2s_set_clk(i2s_out_num, s_rate, 16, 2);
 	}
+	sd_lock();
 	fclose(f);
+	sd_unlock();
 
 	vTaskDelay(1000 / portTICK_PERIOD_MS);
 	STL_STATE = false;
 }
 
+static FILE* open_track(uint32_t* n_frames)
+{
+#if CONFIG_SPECBOX_LIGHT_TRACK
+	track_header_t hdr;
+	FILE* t = fopen(MONOMAN_TRACK, "r");
+	if(t == NULL){
+		ESP_LOGI(TAG, "No light track, using live analysis");
+		return NULL;
+	}
+	if(fread(&hdr, 1, sizeof(hdr), t) != sizeof(hdr) || memcmp(hdr.magic, TRACK_MAGIC, 4) != 0 ||
+			hdr.version != TRACK_VERSION || hdr.n_bands != HN_LED || hdr.scale == 0 ||
+			hdr.hop_bytes != CSIZE){
+		ESP_LOGE(TAG, "Invalid light track: %s", MONOMAN_TRACK);
+		fclose(t);
+		return NULL;
+	}
+	track_scale = hdr.scale;
+	*n_frames = hdr.n_frames;
+	ESP_LOGI(TAG, "Light track: %u frames", hdr.n_frames);
+	return t;
+#else
+	return NULL;
+#endif
+}
+
 void play_default(void* param)
 {
+	sd_stream_t stream;
 	ESP_LOGI(TAG, "Executing: %s", __func__);
-	FILE* f = fopen(MONOMAN, "r");
-	if(f == NULL){
+	if(!sd_stream_open(&stream, MONOMAN)){
 		MODE = NO_MODE;
 		ESP_LOGE(TAG, "Problems");
-		vTaskDelete(NULL);
+		def_handle = NULL;
+		task_exit(TASK_DEFAULT);
 	}
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f) - 60000;
-    rewind(f);
-    uint8_t buffer[CSIZE];
+    size_t size = stream.size - 60000;
+    const uint8_t* buffer;
+    uint8_t bands[HN_LED];
     size_t pos;
     uint32_t ins = STOP_DEF;
+    uint32_t n_frames = 0, frame;
+    sd_lock();
+    FILE* t = open_track(&n_frames);
+    sd_unlock();
+    bool have_bands;
 	uint32_t s_rate = i2s_get_clk(i2s_out_num);
 
 	while(ins == STOP_DEF) xTaskNotifyWait(0, 0, &ins, portMAX_DELAY);
@@ -151,8 +286,13 @@ void play_default(void* param)
 	}
 
     while(ins != ABORT){
-    	fseek(f, 44, SEEK_SET);
-    	pos = 44;
+    	pos = WAV_HEADER_SIZE;
+    	frame = 0;
+    	if(t != NULL){
+    		sd_lock();
+    		fseek(t, sizeof(track_header_t), SEEK_SET);
+    		sd_unlock();
+    	}
 		i2s_zero_dma_buffer(i2s_out_num);
     	while((size - pos) > CSIZE)
 		{
@@ -170,63 +310,226 @@ void play_default(void* param)
 				}
 			}
 			while(STL_STATE) vTaskDelay(400 / portTICK_PERIOD_MS);
-			fread(buffer, 1, CSIZE, f);
-			write_ringbuf(buffer, CSIZE);
+			if((buffer = sd_stream_read(&stream, pos, CSIZE)) == NULL){
+				// set_mode must not notify a task that is gone
+				ESP_LOGE(TAG, "Read failed at %zu", pos);
+				MODE = NO_MODE;
+				ins = ABORT;
+				break;
+			}
+			have_bands = false;
+			if(t != NULL && frame < n_frames){
+				sd_lock();
+				have_bands = fread(bands, 1, HN_LED, t) == HN_LED;
+				sd_unlock();
+			}
+			if(have_bands) write_ringbuf_track(buffer, CSIZE, bands);
+			else write_ringbuf(buffer, CSIZE);
 			pos += CSIZE;
+			frame += 1;
 		}
     }
     def_handle = NULL;
-    fclose(f);
+    sd_stream_close(&stream);
+    if(t != NULL){
+    	sd_lock();
+    	fclose(t);
+    	sd_unlock();
+    }
     ESP_LOGI(TAG, "Stopped %s", __func__);
-    vTaskDelete(NULL);
+    task_exit(TASK_DEFAULT);
+}
+
+// Mode switches run as a state machine on the A2DP connection and profile
+// events, which arrive on the dispatcher through bt_av_hdl_a2d_evt. Each wait
+// is backed by a timeout that moves the machine on regardless. Default audio
+// starts right away while Bluetooth is still tearing down.
+#define MS_IDLE						0
+#define MS_BT_DISCONNECT			1
+#define MS_BT_DEINIT				2
+#define MS_BT_INIT					3
+#define MS_BT_CONNECT				4
+#define MODE_IDLE_BIT				(1 << 0)
+
+static const char* const mode_state_name[] = { "idle", "disconnect", "deinit", "init", "connect" };
+static uint8_t mode_state = MS_IDLE;
+static bool a2d_connected = false;
+static esp_bd_addr_t mode_peer;
+static TimerHandle_t mode_timer;
+static StaticTimer_t mode_timer_buf;
+static EventGroupHandle_t mode_events;
+static StaticEventGroup_t mode_events_buf;
+mode_transition_t mode_transition;
+
+static void mode_timer_expired(TimerHandle_t timer);
+
+static void mode_step(uint8_t state)
+{
+	mode_state = state;
+	xEventGroupClearBits(mode_events, MODE_IDLE_BIT);
+	xTimerReset(mode_timer, 0);
+}
+
+static void mode_done(void)
+{
+	mode_state = MS_IDLE;
+	xTimerStop(mode_timer, 0);
+	mode_transition.settled_us = esp_timer_get_time() - mode_transition.start_us;
+	if(mode_transition.audio_us == 0) mode_transition.audio_us = mode_transition.settled_us;
+	ESP_LOGI(TAG, "Mode %d -> %d: audio after %u ms, settled after %u ms",
+			mode_transition.from, mode_transition.to,
+			(uint32_t)(mode_transition.audio_us / 1000), (uint32_t)(mode_transition.settled_us / 1000));
+	xEventGroupSetBits(mode_events, MODE_IDLE_BIT);
+}
+
+static void bt_bring_up(void)
+{
+	esp_a2d_sink_init();
+	mode_step(MS_BT_INIT);
+}
+
+static void bt_tear_down(void)
+{
+	if(a2d_connected){
+		esp_a2d_sink_disconnect(mode_peer);
+		mode_step(MS_BT_DISCONNECT);
+	}
+	else{
+		esp_a2d_sink_deinit();
+		mode_step(MS_BT_DEINIT);
+	}
+}
+
+// Advances the machine once the step it waited for is over, by event or timeout
+static void mode_advance(uint8_t state)
+{
+	if(state != mode_state) return;
+	switch(state){
+	case MS_BT_DISCONNECT:
+		esp_a2d_sink_deinit();
+		mode_step(MS_BT_DEINIT);
+		break;
+	case MS_BT_DEINIT:
+		if(MODE == BLUETOOTH_MODE) bt_bring_up();
+		else mode_done();
+		break;
+	case MS_BT_INIT:
+		narrate(SWITCH_BT);
+		esp_a2d_sink_connect(mode_peer);
+		xTaskNotify(s_i2s_task_handle, (uint32_t)BT_VOL, eSetValueWithOverwrite);
+		mode_step(MS_BT_CONNECT);
+		break;
+	case MS_BT_CONNECT:
+		mode_done();
+		break;
+	}
+}
+
+void mode_a2d_event(uint16_t event, esp_a2d_cb_param_t *a2d)
+{
+	if(mode_events == NULL) return;
+	switch(event){
+	case ESP_A2D_CONNECTION_STATE_EVT:
+		if(a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_CONNECTED){
+			a2d_connected = true;
+			if(mode_state == MS_BT_CONNECT) mode_transition.audio_us = esp_timer_get_time() - mode_transition.start_us;
+			mode_advance(MS_BT_CONNECT);
+		}
+		else if(a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED){
+			a2d_connected = false;
+			mode_advance(MS_BT_DISCONNECT);
+		}
+		break;
+	case ESP_A2D_PROF_STATE_EVT:
+		if(a2d->a2d_prof_stat.init_state == ESP_A2D_INIT_SUCCESS) mode_advance(MS_BT_INIT);
+		else mode_advance(MS_BT_DEINIT);
+		break;
+	}
+}
+
+static void mode_timeout(uint16_t state, void *param)
+{
+	if(state != mode_state) return;
+	ESP_LOGW(TAG, "Mode switch: no event in %s, moving on", mode_state_name[state]);
+	mode_advance(state);
+}
+
+static void mode_timer_expired(TimerHandle_t timer)
+{
+	app_work_dispatch(mode_timeout, mode_state, NULL, 0);
+}
+
+bool mode_wait_idle(uint32_t timeout_ms)
+{
+	if(mode_events == NULL) return true;
+	return xEventGroupWaitBits(mode_events, MODE_IDLE_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms)) & MODE_IDLE_BIT;
 }
 
 void set_mode(uint16_t event, void *param){
+	uint16_t prev = MODE;
+
 	if(MODE == event){
 		return;
 	}
-	esp_bd_addr_t cma;
-	memcpy(cma, param, ESP_BD_ADDR_LEN);
+	if(mode_events == NULL){
+		mode_events = xEventGroupCreateStatic(&mode_events_buf);
+		mode_timer = xTimerCreateStatic("mode", pdMS_TO_TICKS(MODE_STEP_TIMEOUT_MS), pdFALSE, NULL,
+				mode_timer_expired, &mode_timer_buf);
+		xEventGroupSetBits(mode_events, MODE_IDLE_BIT);
+	}
+	memcpy(mode_peer, param, ESP_BD_ADDR_LEN);
+	mode_transition.from = prev;
+	mode_transition.to = event;
+	mode_transition.start_us = esp_timer_get_time();
+	mode_transition.audio_us = 0;
+	// set first: A2DP audio still arriving during teardown is dropped
+	MODE = event;
+	// sleep goes through NO_MODE; the next wake resumes the mode picked before
+	if(event != NO_MODE) persist_set_mode(event);
+
+	if(prev == DEFAULT_MODE){
+		xTaskNotify(def_handle, STOP_DEF, eSetValueWithOverwrite);
+	}
+	else if(prev == BLUETOOTH_MODE && (mode_state == MS_IDLE || mode_state >= MS_BT_INIT)){
+		bt_tear_down();
+	}
 
 	switch(event){
 	case NO_MODE:
-		if(MODE == DEFAULT_MODE){
-			xTaskNotify(def_handle, STOP_DEF, eSetValueWithOverwrite);
-		}
-		else if(MODE == BLUETOOTH_MODE){
-			esp_a2d_sink_disconnect(cma);
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-			esp_a2d_sink_deinit();
-		}
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
 		i2s_zero_dma_buffer(i2s_out_num);
 		break;
 	case DEFAULT_MODE:
-		if(MODE == BLUETOOTH_MODE){
-			esp_a2d_sink_disconnect(cma);
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-			esp_a2d_sink_deinit();
-		}
+#if CONFIG_SPECBOX_LATENCY_AUTO
+		set_latency_profile(LATENCY_LOW, NULL);
+#endif
 		narrate(SWITCH_DEFAULT);
 		xTaskNotify(def_handle, START_DEF, eSetValueWithOverwrite);
+		mode_transition.audio_us = esp_timer_get_time() - mode_transition.start_us;
 		break;
 	case BLUETOOTH_MODE:
-		if(MODE == DEFAULT_MODE){
-			xTaskNotify(def_handle, STOP_DEF, eSetValueWithOverwrite);
-		}
-		esp_a2d_sink_init();
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
-		narrate(SWITCH_BT);
-		esp_a2d_sink_connect(cma);
-		xTaskNotify(s_i2s_task_handle, (uint32_t)BT_VOL, eSetValueWithOverwrite);
+#if CONFIG_SPECBOX_LATENCY_AUTO
+		set_latency_profile(LATENCY_ROBUST, NULL);
+#endif
+		// with a teardown in flight, bring-up follows its deinit
+		if(mode_state == MS_IDLE) bt_bring_up();
 		break;
 	}
-	MODE = event;
+	if(mode_state == MS_IDLE) mode_done();
+#if CONFIG_SPECBOX_GOVERNOR
+	governor_kick();
+#endif
+}
+
+void set_latency_profile(uint16_t event, void *param){
+	if(event < LATENCY_PROFILE_COUNT && event != latency_profile){
+		request_latency_profile(event);
+	}
 }
 
 void change_volume(uint16_t event, void *param){
 	if(event <= 10 && MODE == DEFAULT_MODE){
 		xTaskNotify(s_i2s_task_handle, (uint32_t)event, eSetValueWithOverwrite);
+		persist_set_volume(event);
 	}
 }
 
@@ -281,18 +584,91 @@ void set_light(uint16_t event, void *param){
 	}
 	switch(event){
 	case LIGHT_ON:
-		xTaskNotify(color_handle, START_LGT, eSetValueWithOverwrite);
+	case LIGHT_VU:
+		if(LGT == LIGHT_OFF) xTaskNotify(color_handle, START_LGT, eSetValueWithOverwrite);
 		break;
 	case LIGHT_OFF:
 		xTaskNotify(color_handle, STOP_LGT, eSetValueWithOverwrite);
 		break;
 	}
 	LGT = event;
+#if CONFIG_SPECBOX_GOVERNOR
+	governor_kick();
+#endif
 }
 
 // ------------------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------------------
 
+#define SYNC_QUEUE_LEN 16
+#define VU_PERIOD_MS 30
+
+#if SYNC_BANDS != HN_LED
+#error "sync frames carry one band per LED pair"
+#endif
+
+typedef struct {
+	int64_t due;
+	uint8_t rgb[HN_LED][3];
+	uint8_t neon[2];
+} light_frame_t;
+
+static light_frame_t sync_queue[SYNC_QUEUE_LEN];
+static uint8_t sync_head = 0, sync_count = 0;
+uint32_t sync_latency_ms = 0;
+
+// Light frames wait here until the audio they were computed from reaches the DAC.
+static light_frame_t* sync_push(int64_t due)
+{
+	light_frame_t* fr;
+	if(sync_count == SYNC_QUEUE_LEN){
+		sync_head = (sync_head + 1) % SYNC_QUEUE_LEN;
+		sync_count -= 1;
+	}
+	fr = &sync_queue[(sync_head + sync_count) % SYNC_QUEUE_LEN];
+	sync_count += 1;
+	fr->due = due;
+	return fr;
+}
+
+static light_frame_t* sync_release(int64_t now)
+{
+	light_frame_t* fr = NULL;
+	while(sync_count > 0 && sync_queue[sync_head].due <= now){
+		fr = &sync_queue[sync_head];
+		sync_head = (sync_head + 1) % SYNC_QUEUE_LEN;
+		sync_count -= 1;
+	}
+	return fr;
+}
+
+static TickType_t sync_wait(int64_t now)
+{
+	const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+	int64_t d;
+	if(sync_count == 0) return 100 / portTICK_PERIOD_MS;
+	d = sync_queue[sync_head].due - now;
+	if(d <= 0) return 0;
+	return (d + tick_us - 1) / tick_us;
+}
+
+// VU bar over HN_LED pixels from first: lit up to the level along the low-to-high ramp
+static void vu_bar(led_strip_t *strip, uint16_t first, uint8_t level, const uint8_t* L, const uint8_t* H, uint8_t br)
+{
+	uint16_t i, lit = (level * HN_LED + 127) / 255;
+	uint8_t R, G, B;
+
+	for(i = 0; i < HN_LED; i++){
+		R = G = B = 0;
+		if(i < lit){
+			R = L[0] + (H[0] - L[0]) * i / (HN_LED - 1);
+			G = L[1] + (H[1] - L[1]) * i / (HN_LED - 1);
+			B = L[2] + (H[2] - L[2]) * i / (HN_LED - 1);
+		}
+		strip->set_pixel(strip, first + i, R * br / 255, G * br / 255, B * br / 255);
+	}
+}
+
 static void increment_color(uint8_t* C, bool* direction, uint8_t* index){
 	if(*direction) C[*index] += 1;
 	else C[*index] -= 1;
@@ -315,11 +691,19 @@ void process_colors(void *param)
 
 	// --------------------------------------------------------------------------------------------
 
-	uint8_t L_COLOR[3] = {0xff, 0x00, 0x00};
-	uint8_t H_COLOR[3] = {0xff, 0x80, 0x00};
-	bool L_SLOPE = true, H_SLOPE = true;
-	uint8_t LCI = 1, HCI = 1;
+	// cold start values; a warm start takes the state the last session left
+	light_state_t ls = {
+		.min = {MAXFLOAT},
+		.l_color = {0xff, 0x00, 0x00},
+		.h_color = {0xff, 0x80, 0x00},
+		.l_slope = true, .h_slope = true,
+		.lci = 1, .hci = 1,
+	};
+	bool warm = persist_light_get(&ls);
+	uint8_t* const L_COLOR = ls.l_color;
+	uint8_t* const H_COLOR = ls.h_color;
 	uint8_t INCR_WAIT = 0;
+	uint16_t persist_frames = 0;
 
 	// -----------------------------------------------------------------------------------------------
 	// ================================
@@ -328,34 +712,53 @@ void process_colors(void *param)
 	uint8_t R, G, B;
 	uint16_t i, j, k;
 	int16_t left, right;
-	float fft_table[CHUNK_SIZE] = {0};
-	float flt_d[2*CHUNK_SIZE] = {0};
-	float spectrum[HALF_CS] = {0};
+	float* const flt_d = dsp_work.data;
+	float* const spectrum = dsp_work.data;
 	float CD[HN_LED];
 	const uint16_t spi[87] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 18, 19, 20, 22, 23, 25, 26, 28, 30, 31, 33, 35, 37, 39, 42, 44, 46, 49, 51, 54, 57, 60, 63, 66, 69, 73, 76, 80, 84, 88, 92, 96, 101, 105, 110, 115, 121, 126, 132, 138, 144, 151, 157, 164, 172, 179, 187, 195, 204, 213, 222, 232, 242, 252, 263, 275, 286, 299, 311, 325, 339, 353, 368, 384, 400, 417, 435, 453, 472, 511};
 	const uint8_t spi_index[9][2] = {{0, 5}, {4, 10}, {9, 16}, {15, 24}, {23, 34}, {33, 45}, {44, 57}, {56, 71}, {70, 86}};
 
-	float r, V;
-	float rate[HN_LED] = {0};
-	float MAX[HN_LED] = {0};
-	float MIN[HN_LED] = {MAXFLOAT};
-	float CS[HN_LED] = {0};
+	float r, V, lift;
+	float* const rate = ls.rate;
+	float* const MAX = ls.max;
+	float* const MIN = ls.min;
+	float* const CS = ls.cs;
 	float LD, RD, max_cd;
 	uint32_t lgt = STOP_LGT;
+	light_frame_t* fr;
+	int64_t now, due = 0;
+	bool fresh, vu;
+	uint16_t sync_log = 0;
+	uint8_t hop_count = 0, br = 255;
+	int64_t last_refresh = 0;
+	const float pulse_gain = CONFIG_SPECBOX_BEAT_PULSE / 100.0f;
+#if CONFIG_SPECBOX_BEAT_BENCH
+	int64_t t_an = 0, t_beat = 0, t0;
+	uint16_t bench_frames = 0;
+#endif
+#if CONFIG_SPECBOX_TRACE
+	trc_light_t trc = { 0 };
+	trc_show_t show;
+	uint8_t bands_src = TRC_BANDS_SILENCE;
+#endif
 
 	led_strip_t *strip = NULL;
 	strip = led_strip_init(RMT_CHANNEL_0, WS2812B_DOUT, N_LED);
 	if(strip == NULL){
 		ESP_LOGE(TAG, "Problems with Strip");
-		vTaskDelete(NULL);
+		color_handle = NULL;
+		task_exit(TASK_COLOR);
 	}
 	//---------------------------------------------------------------------------------------------
 
-	dsps_fft2r_init_fc32(fft_table, CHUNK_SIZE);
+	dsps_fft2r_init_fc32(dsp_work.fft_table, CHUNK_SIZE);
 	dac_output_enable(NEON_1);
 	dac_output_enable(NEON_2);
 
 	strip->clear(strip, 500);
+	beat_reset();
+	boot_mark(BOOT_ANALYZER);
+	ESP_LOGI(TAG, "Light normalization: %s start", warm ? "warm" : "cold");
 	while(lgt == STOP_LGT) xTaskNotifyWait(0, 0, &lgt, portMAX_DELAY);
 
 	while(lgt != ABORT){
@@ -365,36 +768,123 @@ void process_colors(void *param)
 				strip->set_pixel(strip, i + HN_LED, H_COLOR[0], H_COLOR[1], H_COLOR[2]);
 			}
 			strip->refresh(strip, 100);
+			boot_mark(BOOT_FIRST_LIGHT);
 			dac_output_voltage(NEON_1, 255);
 			dac_output_voltage(NEON_2, 255);
+			sync_count = 0;
+			fresh = false;
+			vu = false;
+		}
+		else if((vu = LGT == LIGHT_VU)){
+			// no analysis: paced by the audio blocks, levels from the I2S task's envelope
+			xSemaphoreTake(cdat_semaphore, VU_PERIOD_MS / portTICK_PERIOD_MS);
+			now = esp_timer_get_time();
+			sync_count = 0;
+			fresh = false;
+			if(gov.fps == 0 || now - last_refresh >= 1000000 / gov.fps){
+				last_refresh = now;
+				vu_bar(strip, 0, env_level[0], L_COLOR, H_COLOR, gov.brightness);
+				vu_bar(strip, HN_LED, env_level[1], L_COLOR, H_COLOR, gov.brightness);
+				strip->refresh(strip, 100);
+				boot_mark(BOOT_FIRST_LIGHT);
+			}
+		}
+		else if(sync_link_poll(now = esp_timer_get_time())){
+			// sync follower: the leader's bands stand in for the analysis
+			xSemaphoreTake(cdat_semaphore, sync_link_wait(now, sync_wait(now)));
+			now = esp_timer_get_time();
+			fresh = sync_link_follow(now, CD, &due);
+			if(fresh) beat_bands(CD, HN_LED);
+#if CONFIG_SPECBOX_TRACE
+			bands_src = TRC_BANDS_SYNC;
+#endif
 		}
 		else{
-			if(xSemaphoreTake(cdat_semaphore, 100 / portTICK_PERIOD_MS) == pdTRUE){
-				for(i = 0; i < CHUNK_SIZE; i++){
-					left = *((int16_t*)(buffer + 4*i));
-					right = *((int16_t*)(buffer + 4*i + 2));
-					flt_d[2*i] = ((float)(left + right)) / 2.0f;
-					flt_d[2*i+1] = 0.0f;
+			fresh = xSemaphoreTake(cdat_semaphore, sync_wait(esp_timer_get_time())) == pdTRUE;
+			// the wait can last 100 ms, silence frames are due when it ends
+			now = esp_timer_get_time();
+			if(fresh){
+				due = get_col_due() + CONFIG_SPECBOX_LIGHT_SYNC_OFFSET_MS * 1000;
+				sync_latency_ms = due > now ? (due - now) / 1000 : 0;
+				if(++sync_log == 512){
+					sync_log = 0;
+					ESP_LOGI(TAG, "Light sync latency: %u ms", sync_latency_ms);
 				}
-				if(dsps_fft2r_fc32_ae32_(flt_d, CHUNK_SIZE, fft_table) != ESP_OK){ continue; }
-				for(i = 0; i < HALF_CS; i++){
-					spectrum[i] = fabs(flt_d[2*i]) + fabs(flt_d[2*i + 1]);
+#if CONFIG_SPECBOX_TRACE
+				trc.seq = col_seq;
+				bands_src = TRK_STATE ? TRC_BANDS_TRACK : TRC_BANDS_FFT;
+#endif
+				if(TRK_STATE){
+					for(i = 0; i < HN_LED; i++){
+						CD[i] = exp2f((float)col_track[i] / track_scale) - 1.0f;
+					}
+					beat_bands(CD, HN_LED);
+				}
+				else if(gov.hop > 1 && ++hop_count % gov.hop != 0){
+					// governor hop: keep the previous bands for this block
+					beat_hold();
+#if CONFIG_SPECBOX_TRACE
+					bands_src = TRC_BANDS_HELD;
+#endif
 				}
+				else{
+#if CONFIG_SPECBOX_BEAT_BENCH
+					t0 = esp_timer_get_time();
+#endif
+					for(i = 0; i < CHUNK_SIZE; i++){
+						left = *((int16_t*)(buffer + 4*i));
+						right = *((int16_t*)(buffer + 4*i + 2));
+						flt_d[2*i] = ((float)(left + right)) / 2.0f;
+						flt_d[2*i+1] = 0.0f;
+					}
+					if(dsps_fft2r_fc32_ae32_(flt_d, CHUNK_SIZE, dsp_work.fft_table) != ESP_OK){ continue; }
+					// in place: bin i only reads entries at 2i and up
+					for(i = 0; i < HALF_CS; i++){
+						spectrum[i] = fabs(flt_d[2*i]) + fabs(flt_d[2*i + 1]);
+					}
 
-				for(i = 0; i < HN_LED; i++){
-					CD[i] = 0.0f;
-					for(k = spi_index[i][0]; k <= spi_index[i][1] - 2; k++){
-						max_cd = 0.0f;
-						for(j = spi[i] + 1; j < spi[i + 1]; j++) max_cd += spectrum[j] * (spi[i + 1] - j) / (spi[i + 1] - spi[i]);
-						for(j = spi[i + 1]; j < spi[i + 2]; j++) max_cd += spectrum[j] * (spi[i + 2] - j) / (spi[i + 2] - spi[i + 1]);
-						if(max_cd > CD[i]) CD[i] = max_cd;
+					for(i = 0; i < HN_LED; i++){
+						CD[i] = 0.0f;
+						for(k = spi_index[i][0]; k <= spi_index[i][1] - 2; k++){
+							max_cd = 0.0f;
+							for(j = spi[i] + 1; j < spi[i + 1]; j++) max_cd += spectrum[j] * (spi[i + 1] - j) / (spi[i + 1] - spi[i]);
+							for(j = spi[i + 1]; j < spi[i + 2]; j++) max_cd += spectrum[j] * (spi[i + 2] - j) / (spi[i + 2] - spi[i + 1]);
+							if(max_cd > CD[i]) CD[i] = max_cd;
+						}
+					}
+#if CONFIG_SPECBOX_BEAT_BENCH
+					t_an += esp_timer_get_time() - t0;
+					t0 = esp_timer_get_time();
+#endif
+					beat_spectrum(spectrum, spi, sizeof(spi) / sizeof(spi[0]));
+#if CONFIG_SPECBOX_BEAT_BENCH
+					t_beat += esp_timer_get_time() - t0;
+					if(++bench_frames == 512){
+						ESP_LOGI(TAG, "Beat: %u bpm (confidence %u%%), %u us/frame against analysis %u us/frame",
+								(uint32_t)(beat.bpm + 0.5f), (uint32_t)(beat.confidence * 100),
+								(uint32_t)(t_beat / bench_frames), (uint32_t)(t_an / bench_frames));
+						t_an = t_beat = 0;
+						bench_frames = 0;
 					}
+#endif
 				}
 			}
-			else{
+			else if(sync_count == 0){
+				fresh = true;
+				due = now;
 				for(i = 0; i < HN_LED; i++){ CD[i] = 0.0f; }
+#if CONFIG_SPECBOX_TRACE
+				bands_src = TRC_BANDS_SILENCE;
+#endif
 			}
+#if !CONFIG_SPECBOX_LIGHT_SYNC
+			due = now;
+#endif
+		}
 
+		if(fresh){
+			// sync leader: sends the bands, later due for the playout delay
+			sync_link_lead(&due, CD);
 			for(i = 0; i < HN_LED; i++){
 				r = (CD[i] - CS[i]) * SMOOTHNESS;
 				if(fabsf(r) > rate[i]){rate[i] = r;}
@@ -402,10 +892,18 @@ void process_colors(void *param)
 				MAX[i] = CS[i] >= MAX[i] ? CS[i] : MAX[i] - DROP_RATE * (MAX[i] - CS[i]);
 				MIN[i] = CS[i] <= MIN[i] ? CS[i] : MIN[i] + RISE_RATE * (CS[i] - MIN[i]);
 			}
+			if(++persist_frames == PERSIST_LIGHT_FRAMES){
+				persist_frames = 0;
+				persist_light_put(&ls);
+			}
 
+			fr = sync_push(due);
 			LD = 0.0f; RD = 0.0f;
+			// beat flash: lifts every pair towards full, fading over the beat
+			lift = pulse_gain * beat.pulse;
 			for(i = 0; i < HN_LED; i++){
 				V = MAX[i] == MIN[i] ? 0.0f : (CS[i] - MIN[i]) / (MAX[i] - MIN[i]);
+				V += lift * (1.0f - V);
 				if(i<HNL) LD += V;
 				else RD += V;
 
@@ -418,26 +916,66 @@ void process_colors(void *param)
 					G = L_COLOR[1] + floorf((float)(H_COLOR[1] - L_COLOR[1]) * V);
 					B = L_COLOR[2] + floorf((float)(H_COLOR[2] - L_COLOR[2]) * V);
 				}
-				strip->set_pixel(strip, i, R, G, B);
-				strip->set_pixel(strip, i + HN_LED, R, G, B);
+				fr->rgb[i][0] = R;
+				fr->rgb[i][1] = G;
+				fr->rgb[i][2] = B;
 			}
-			strip->refresh(strip, 100);
-			dac_output_voltage(NEON_1, 35 + floorf((LD / HNL) * 220));
-			dac_output_voltage(NEON_2, 35 + floorf((RD / HNR) * 220));
+			fr->neon[0] = 35 + floorf((LD / HNL) * 220);
+			fr->neon[1] = 35 + floorf((RD / HNR) * 220);
+			gov_light_level = (LD + RD) / HN_LED;
+#if CONFIG_SPECBOX_TRACE
+			memcpy(trc.rgb, fr->rgb, sizeof(trc.rgb));
+			memcpy(trc.neon, fr->neon, sizeof(trc.neon));
+			trc.lift = lift;
+			trace_put(TRC_LIGHT, bands_src, &trc, sizeof(trc));
+#endif
 		}
 
-		if(INCR_WAIT < 10) INCR_WAIT += 1;
-		else {
-			INCR_WAIT = 0;
-			increment_color(H_COLOR, &H_SLOPE, &HCI);
-			increment_color(L_COLOR, &L_SLOPE, &LCI);
+		if(!OVL_STATE && !vu && (fr = sync_release(now = esp_timer_get_time())) != NULL){
+			deadline_stats.light_frames += 1;
+			if(now - fr->due > LIGHT_DEADLINE_US) deadline_stats.light_misses += 1;
+			// governor frame cap: a frame due too soon after the last one is dropped
+			if(gov.fps == 0 || now - last_refresh >= 1000000 / gov.fps){
+				last_refresh = now;
+				br = gov.brightness;
+				for(i = 0; i < HN_LED; i++){
+					R = fr->rgb[i][0] * br / 255;
+					G = fr->rgb[i][1] * br / 255;
+					B = fr->rgb[i][2] * br / 255;
+					strip->set_pixel(strip, i, R, G, B);
+					strip->set_pixel(strip, i + HN_LED, R, G, B);
+				}
+				strip->refresh(strip, 100);
+				boot_mark(BOOT_FIRST_LIGHT);
+#if !CONFIG_SPECBOX_NEON_ENVELOPE
+				dac_output_voltage(NEON_1, fr->neon[0] * br / 255);
+				dac_output_voltage(NEON_2, fr->neon[1] * br / 255);
+#endif
+			}
+#if CONFIG_SPECBOX_TRACE
+			show.late_us = now - fr->due;
+			show.brightness = gov.brightness;
+			trace_put(TRC_SHOW, last_refresh == now, &show, sizeof(show));
+#endif
+		}
+
+		if(fresh || OVL_STATE || vu){
+			if(INCR_WAIT < 10) INCR_WAIT += 1;
+			else {
+				INCR_WAIT = 0;
+				increment_color(H_COLOR, &ls.h_slope, &ls.hci);
+				increment_color(L_COLOR, &ls.l_slope, &ls.lci);
+			}
 		}
 
 		if(xTaskNotifyWait(0, 0xffffffff, &lgt, 0) == pdTRUE){
 			if(lgt == STOP_LGT){
 				strip->clear(strip, 500);
 				dac_output_voltage(NEON_1, 0);
+				sync_count = 0;
+				persist_light_put(&ls);
 				while(lgt == STOP_LGT) xTaskNotifyWait(0, 0, &lgt, portMAX_DELAY);
+				beat_reset();
 			}
 		}
 	}
@@ -445,9 +983,10 @@ void process_colors(void *param)
 	dac_output_voltage(NEON_1, 0);
 	dac_output_voltage(NEON_2, 0);
 	led_strip_denit(strip);
+	persist_light_put(&ls);
 
 	color_handle = NULL;
 	ESP_LOGI(TAG, "Stopped %s", __func__);
-	vTaskDelete(NULL);
+	task_exit(TASK_COLOR);
 }
 
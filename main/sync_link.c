@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "app_core.h"
+#include "esp_bt_device.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sync_proto.h"
+
+#define TAG "SYNC"
+
+// Box side of sync_proto: messages go out as SYNC_FRAME_SYNC frames on the
+// controller's SPP link and come back through the command parser. SPP is a
+// single link per box, so the controller app relays between boxes. The node is
+// shared by the command task (receive), the color task (frames, pings) and the
+// dispatcher (role changes), so every call holds sync_lock.
+static sync_node_t node;
+static xSemaphoreHandle sync_lock;
+static StaticSemaphore_t sync_lock_buf;
+static int64_t last_ping = 0;
+static uint8_t last_role = SYNC_ROLE_OFF;
+
+static void spp_send(void *ctx, const uint8_t *msg, size_t len)
+{
+	spp_frame_send(SYNC_FRAME_SYNC, SYNC_PROTO_VERSION, msg, len);
+}
+
+static int64_t box_clock(void *ctx)
+{
+	return esp_timer_get_time();
+}
+
+static const sync_transport_t spp_transport = { NULL, spp_send, box_clock };
+
+void sync_link_init(void)
+{
+	sync_lock = xSemaphoreCreateMutexStatic(&sync_lock_buf);
+	sync_init(&node, SYNC_ROLE_OFF, 0, &spp_transport, CONFIG_SPECBOX_SYNC_PLAYOUT_MS * 1000LL, LIGHT_DEADLINE_US);
+}
+
+// event: SYNC_ROLE_OFF, _LEADER or _FOLLOWER
+void set_sync_role(uint16_t event, void *param)
+{
+	const uint8_t *mac = esp_bt_dev_get_address();
+
+	if(event > SYNC_ROLE_FOLLOWER) return;
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	if(node.role != event){
+		// pings are matched on the id: the low address byte tells boxes apart
+		sync_init(&node, event, mac != NULL ? mac[5] : 0, &spp_transport,
+				CONFIG_SPECBOX_SYNC_PLAYOUT_MS * 1000LL, LIGHT_DEADLINE_US);
+		last_ping = 0;
+		ESP_LOGI(TAG, "Role %u", event);
+	}
+	xSemaphoreGive(sync_lock);
+}
+
+// From the command task, stamp: when the SPP data arrived
+void sync_link_rx(const uint8_t *msg, uint8_t len, int64_t stamp)
+{
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	sync_rx(&node, msg, len, stamp);
+	xSemaphoreGive(sync_lock);
+}
+
+// Leader: sends the bands and moves *due to when every box shows them
+void sync_link_lead(int64_t *due, const float *cd)
+{
+	uint8_t q[SYNC_BANDS];
+	int i;
+
+	if(node.role != SYNC_ROLE_LEADER) return;
+	for(i = 0; i < SYNC_BANDS; i++) q[i] = sync_band_q(cd[i]);
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	if(node.role == SYNC_ROLE_LEADER) *due = sync_send_frame(&node, *due, q);
+	xSemaphoreGive(sync_lock);
+}
+
+// Follower: pings when due; true while the leader's frames are to be shown.
+// Falls back to the box's own analysis until the clock is estimated and after
+// SYNC_LOSS_US without frames.
+bool sync_link_poll(int64_t now)
+{
+	bool following;
+
+	if(node.role != SYNC_ROLE_FOLLOWER){
+		last_role = node.role;
+		return false;
+	}
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	// ping faster until the first estimate is in
+	if(now - last_ping >= (sync_synced(&node) ? CONFIG_SPECBOX_SYNC_PING_MS : CONFIG_SPECBOX_SYNC_PING_MS / 4) * 1000LL){
+		last_ping = now;
+		sync_send_ping(&node, now);
+	}
+	following = sync_following(&node, now);
+	if(following && last_role != SYNC_ROLE_FOLLOWER) ESP_LOGI(TAG, "Following, offset %" PRId64 " us, rtt %" PRId64 " us", node.offset, node.rtt);
+	else if(!following && last_role == SYNC_ROLE_FOLLOWER) ESP_LOGW(TAG, "Leader lost");
+	last_role = following ? SYNC_ROLE_FOLLOWER : SYNC_ROLE_OFF;
+	xSemaphoreGive(sync_lock);
+	return following;
+}
+
+// Ticks until the next leader frame is close, at most max
+TickType_t sync_link_wait(int64_t now, TickType_t max)
+{
+	const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+	int64_t d;
+	TickType_t t;
+
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	d = sync_next_due(&node);
+	xSemaphoreGive(sync_lock);
+	if(d < 0) return max;
+	d -= now + tick_us;
+	if(d <= 0) return 0;
+	t = d / tick_us;
+	return t < max ? t : max;
+}
+
+// Pops the leader frame due within the next tick; the light queue shows it on time
+bool sync_link_follow(int64_t now, float *cd, int64_t *due)
+{
+	sync_frame_t f;
+	bool got;
+	int i;
+
+	xSemaphoreTake(sync_lock, portMAX_DELAY);
+	got = sync_pop(&node, now + portTICK_PERIOD_MS * 1000, &f);
+	xSemaphoreGive(sync_lock);
+	if(!got) return false;
+	for(i = 0; i < SYNC_BANDS; i++) cd[i] = sync_band_e(f.bands[i]);
+	*due = f.due;
+	return true;
+}
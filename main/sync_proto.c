@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "sync_proto.h"
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put64(uint8_t *p, int64_t v)
+{
+	put32(p, (uint64_t)v);
+	put32(p + 4, (uint64_t)v >> 32);
+}
+
+static int64_t get64(const uint8_t *p)
+{
+	return (int64_t)(get32(p) | ((uint64_t)get32(p + 4) << 32));
+}
+
+static void tx(sync_node_t *n, const uint8_t *msg, size_t len)
+{
+	n->stats.tx_bytes += len;
+	n->tp->send(n->tp->ctx, msg, len);
+}
+
+void sync_init(sync_node_t *n, uint8_t role, uint8_t id, const sync_transport_t *tp,
+		int64_t playout_us, int64_t late_us)
+{
+	memset(n, 0, sizeof(*n));
+	n->role = role;
+	n->id = id;
+	n->tp = tp;
+	n->playout_us = playout_us;
+	n->late_us = late_us;
+}
+
+uint8_t sync_band_q(float e)
+{
+	float q = e > 0.0f ? log2f(1.0f + e) * SYNC_BAND_SCALE : 0.0f;
+	return q >= 255.0f ? 255 : (uint8_t)(q + 0.5f);
+}
+
+float sync_band_e(uint8_t q)
+{
+	return exp2f((float)q / SYNC_BAND_SCALE) - 1.0f;
+}
+
+int64_t sync_send_frame(sync_node_t *n, int64_t due, const uint8_t *bands)
+{
+	uint8_t m[SYNC_FRAME_LEN];
+
+	due += n->playout_us;
+	m[0] = SYNC_MSG_FRAME;
+	m[1] = n->frame_seq++;
+	put32(m + 2, (uint32_t)due);
+	memcpy(m + 6, bands, SYNC_BANDS);
+	n->stats.frames_tx += 1;
+	tx(n, m, sizeof(m));
+	return due;
+}
+
+void sync_send_ping(sync_node_t *n, int64_t now)
+{
+	uint8_t m[SYNC_PING_LEN];
+
+	m[0] = SYNC_MSG_PING;
+	m[1] = n->id;
+	m[2] = ++n->ping_seq;
+	put64(m + 3, now);
+	n->ping_t1 = now;
+	n->stats.pings += 1;
+	tx(n, m, sizeof(m));
+}
+
+bool sync_synced(const sync_node_t *n)
+{
+	return n->n_samples >= SYNC_CLOCK_MIN;
+}
+
+bool sync_following(const sync_node_t *n, int64_t now)
+{
+	return n->role == SYNC_ROLE_FOLLOWER && sync_synced(n) && n->last_frame != 0 &&
+			now - n->last_frame < SYNC_LOSS_US;
+}
+
+// offset = ((t2 - t1) + (t3 - t4)) / 2, error bounded by half the round trip
+static void clock_sample(sync_node_t *n, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+	sync_sample_t *s = &n->samples[n->sample_pos];
+	int i, best = 0;
+
+	s->offset = ((t2 - t1) + (t3 - t4)) / 2;
+	s->rtt = (t4 - t1) - (t3 - t2);
+	n->sample_pos = (n->sample_pos + 1) % SYNC_CLOCK_WINDOW;
+	if(n->n_samples < SYNC_CLOCK_WINDOW) n->n_samples += 1;
+	for(i = 1; i < n->n_samples; i++){
+		if(n->samples[i].rtt < n->samples[best].rtt) best = i;
+	}
+	n->offset = n->samples[best].offset;
+	n->rtt = n->samples[best].rtt;
+}
+
+static void jitter_insert(sync_node_t *n, const sync_frame_t *f, int64_t now)
+{
+	int i;
+
+	if(f->due < now - n->late_us){
+		n->stats.frames_late += 1;
+		return;
+	}
+	if(n->jitter_count == SYNC_JITTER_LEN){
+		memmove(n->jitter, n->jitter + 1, (SYNC_JITTER_LEN - 1) * sizeof(sync_frame_t));
+		n->jitter_count -= 1;
+		n->stats.frames_skipped += 1;
+	}
+	// kept in due order; a frame overtaken in transit goes in behind
+	for(i = n->jitter_count; i > 0 && n->jitter[i - 1].due > f->due; i--) n->jitter[i] = n->jitter[i - 1];
+	n->jitter[i] = *f;
+	n->jitter_count += 1;
+}
+
+static void rx_frame(sync_node_t *n, const uint8_t *m, int64_t now)
+{
+	sync_frame_t f;
+	int64_t leader_now = now + n->offset;
+
+	n->stats.frames_rx += 1;
+	if(n->role != SYNC_ROLE_FOLLOWER || !sync_synced(n)) return;
+	// the stamp carries 32 bits, about 71 minutes: unwrap it near the leader's now
+	f.due = leader_now + (int32_t)(get32(m + 2) - (uint32_t)leader_now) - n->offset;
+	f.seq = m[1];
+	memcpy(f.bands, m + 6, SYNC_BANDS);
+	n->last_frame = now;
+	jitter_insert(n, &f, now);
+}
+
+static void rx_ping(sync_node_t *n, const uint8_t *m, int64_t now)
+{
+	uint8_t r[SYNC_PONG_LEN];
+
+	if(n->role != SYNC_ROLE_LEADER) return;
+	r[0] = SYNC_MSG_PONG;
+	memcpy(r + 1, m + 1, 2 + 8);
+	put64(r + 11, now);
+	put64(r + 19, n->tp->clock(n->tp->ctx));
+	n->stats.pongs += 1;
+	tx(n, r, sizeof(r));
+}
+
+static void rx_pong(sync_node_t *n, const uint8_t *m, int64_t now)
+{
+	int64_t t1 = get64(m + 3);
+
+	// only the answer to our latest ping: an older one would carry a stale t1
+	if(n->role != SYNC_ROLE_FOLLOWER || m[1] != n->id || m[2] != n->ping_seq || t1 != n->ping_t1) return;
+	n->stats.pongs += 1;
+	clock_sample(n, t1, get64(m + 11), get64(m + 19), now);
+}
+
+// now: when the message arrived, as early as the transport can tell
+void sync_rx(sync_node_t *n, const uint8_t *msg, size_t len, int64_t now)
+{
+	n->stats.rx_bytes += len;
+	if(len == SYNC_FRAME_LEN && msg[0] == SYNC_MSG_FRAME) rx_frame(n, msg, now);
+	else if(len == SYNC_PING_LEN && msg[0] == SYNC_MSG_PING) rx_ping(n, msg, now);
+	else if(len == SYNC_PONG_LEN && msg[0] == SYNC_MSG_PONG) rx_pong(n, msg, now);
+}
+
+// The newest frame that is due; older due ones are skipped
+bool sync_pop(sync_node_t *n, int64_t now, sync_frame_t *out)
+{
+	int i = 0;
+
+	while(i < n->jitter_count && n->jitter[i].due <= now) i++;
+	if(i == 0) return false;
+	*out = n->jitter[i - 1];
+	n->stats.frames_skipped += i - 1;
+	n->stats.frames_shown += 1;
+	if(now - out->due > n->late_us) n->stats.frames_late += 1;
+	n->jitter_count -= i;
+	memmove(n->jitter, n->jitter + i, n->jitter_count * sizeof(sync_frame_t));
+	return true;
+}
+
+// -1 with nothing queued
+int64_t sync_next_due(const sync_node_t *n)
+{
+	return n->jitter_count ? n->jitter[0].due : -1;
+}
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_core.h"
+#include "sd_stream.h"
+#include "driver/i2s.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#define TAG "TRACE"
+
+#if CONFIG_SPECBOX_TRACE
+
+// Record-and-replay trace. Audio block metadata (and optionally the PCM the
+// analyzer saw), command bytes, dispatcher callbacks and light frames go into
+// one byte ring; when it is full the oldest records are overwritten. A flush
+// writes the ring to the card for trace_replay.py.
+//
+// File: trace_file_t, then records of trace_rec_t followed by `len` bytes.
+#define TRACE_FILE					"/sdcard/trace.bin"
+#define TRACE_MAGIC					"STRC"
+#define TRACE_VERSION				2
+#define TRACE_SIZE					(CONFIG_SPECBOX_TRACE_KB * 1024)
+
+typedef struct __attribute__((packed)) {
+	char magic[4];
+	uint8_t version;
+	uint8_t n_bands;
+	uint16_t block_bytes;
+	uint32_t sample_rate;
+	uint32_t overwritten;
+} trace_file_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t type;
+	uint8_t arg;
+	uint16_t len;
+	uint32_t t_us;
+} trace_rec_t;
+
+static uint8_t trace_ring[TRACE_SIZE];
+static size_t trace_head, trace_tail, trace_used;
+static uint32_t trace_overwritten;
+static bool trace_paused;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+uint16_t col_seq = 0;
+
+static void ring_copy_in(size_t at, const void *src, size_t n)
+{
+	size_t first = n < TRACE_SIZE - at ? n : TRACE_SIZE - at;
+	memcpy(trace_ring + at, src, first);
+	memcpy(trace_ring, (const uint8_t *)src + first, n - first);
+}
+
+static void ring_copy_out(size_t at, void *dst, size_t n)
+{
+	size_t first = n < TRACE_SIZE - at ? n : TRACE_SIZE - at;
+	memcpy(dst, trace_ring + at, first);
+	memcpy((uint8_t *)dst + first, trace_ring, n - first);
+}
+
+// Two payload pieces so callers can add a header to a buffer without copying.
+// Runs in a critical section: keep records small unless PCM tracing is on.
+void trace_put2(uint8_t type, uint8_t arg, const void *a, size_t a_len, const void *b, size_t b_len)
+{
+	trace_rec_t rec;
+	trace_rec_t old;
+	size_t n = sizeof(rec) + a_len + b_len;
+
+	if(n > TRACE_SIZE / 2) return;
+	rec.type = type;
+	rec.arg = arg;
+	rec.len = a_len + b_len;
+	rec.t_us = (uint32_t)esp_timer_get_time();
+
+	portENTER_CRITICAL(&trace_lock);
+	if(trace_paused){
+		trace_overwritten += 1;
+		portEXIT_CRITICAL(&trace_lock);
+		return;
+	}
+	while(TRACE_SIZE - trace_used < n){
+		ring_copy_out(trace_tail, &old, sizeof(old));
+		trace_tail = (trace_tail + sizeof(old) + old.len) % TRACE_SIZE;
+		trace_used -= sizeof(old) + old.len;
+		trace_overwritten += 1;
+	}
+	ring_copy_in(trace_head, &rec, sizeof(rec));
+	ring_copy_in((trace_head + sizeof(rec)) % TRACE_SIZE, a, a_len);
+	if(b_len) ring_copy_in((trace_head + sizeof(rec) + a_len) % TRACE_SIZE, b, b_len);
+	trace_head = (trace_head + n) % TRACE_SIZE;
+	trace_used += n;
+	portEXIT_CRITICAL(&trace_lock);
+}
+
+void trace_put(uint8_t type, uint8_t arg, const void *data, size_t len)
+{
+	trace_put2(type, arg, data, len, NULL, 0);
+}
+
+// Dispatched. Recording pauses while the ring is written out; what arrives in
+// the meantime is counted as overwritten.
+void trace_flush(uint16_t event, void *param)
+{
+	trace_file_t hdr = { TRACE_MAGIC, TRACE_VERSION, HN_LED, CSIZE, 0, 0 };
+	size_t tail, used, first;
+	float rate = i2s_get_clk(i2s_out_num);
+	FILE *f;
+
+	portENTER_CRITICAL(&trace_lock);
+	trace_paused = true;
+	tail = trace_tail;
+	used = trace_used;
+	hdr.overwritten = trace_overwritten;
+	portEXIT_CRITICAL(&trace_lock);
+
+	hdr.sample_rate = rate > 0 ? (uint32_t)rate : 44100;
+	sd_lock();
+	f = fopen(TRACE_FILE, "wb");
+	if(f == NULL){
+		sd_unlock();
+		ESP_LOGE(TAG, "Can't open %s", TRACE_FILE);
+	}
+	else{
+		first = used < TRACE_SIZE - tail ? used : TRACE_SIZE - tail;
+		fwrite(&hdr, sizeof(hdr), 1, f);
+		fwrite(trace_ring + tail, 1, first, f);
+		fwrite(trace_ring, 1, used - first, f);
+		fclose(f);
+		sd_unlock();
+		ESP_LOGI(TAG, "Wrote %zu bytes to %s (%u records overwritten)", used, TRACE_FILE, hdr.overwritten);
+	}
+
+	portENTER_CRITICAL(&trace_lock);
+	trace_head = trace_tail = trace_used = 0;
+	trace_overwritten -= hdr.overwritten;
+	trace_paused = false;
+	portEXIT_CRITICAL(&trace_lock);
+}
+#endif
@@ -0,0 +1,229 @@
+import struct
+import sys
+import time
+from collections import defaultdict
+
+import numpy as np
+
+# Reads a trace written by the firmware (CONFIG_SPECBOX_TRACE, /sdcard/trace.bin),
+# reports timing and feeds the traced audio back through a port of the
+# process_colors analysis as fast as it runs. With PCM in the trace the neon
+# levels of every light frame are recomputed and compared with the recorded
+# ones, so a field capture doubles as a regression test.
+#
+# Layout (little endian):
+#   header  : magic 'STRC', version, n_bands, block bytes, sample rate, overwritten
+#   records : type, arg, length, t_us (low 32 bits of esp_timer), length bytes
+#
+# usage: trace_replay.py trace.bin [--save out.npy] [--expect ref.npy]
+
+MAGIC = b'STRC'
+VERSION = 2
+HEADER = '<4sBBHII'
+RECORD = '<BBHI'
+
+TRC_AUDIO = 1
+TRC_CMD = 2
+TRC_DISPATCH = 3
+TRC_LIGHT = 4
+TRC_SHOW = 5
+
+TRC_SRC_PCM = 0
+TRC_SRC_TRACK = 1
+TRC_BANDS_FFT = 0
+TRC_BANDS_TRACK = 1
+TRC_BANDS_HELD = 2
+TRC_BANDS_SILENCE = 3
+TRC_BANDS_SYNC = 4
+
+CHUNK_SIZE = 1024
+HALF_CS = 512
+TRACK_SCALE = 8
+
+DROP_RATE = np.float32(0.005)
+RISE_RATE = np.float32(0.003)
+THRESHOLD = 0.7
+SMOOTHNESS = np.float32(0.1)
+HNL = 5
+HNR = 4
+
+SPI = [0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 18, 19, 20, 22, 23, 25, 26, 28, 30, 31, 33, 35,
+       37, 39, 42, 44, 46, 49, 51, 54, 57, 60, 63, 66, 69, 73, 76, 80, 84, 88, 92, 96, 101, 105, 110, 115, 121,
+       126, 132, 138, 144, 151, 157, 164, 172, 179, 187, 195, 204, 213, 222, 232, 242, 252, 263, 275, 286, 299,
+       311, 325, 339, 353, 368, 384, 400, 417, 435, 453, 472, 511]
+
+
+def read_trace(path):
+    with open(path, 'rb') as f:
+        raw = f.read()
+    magic, version, n_bands, block_bytes, rate, overwritten = struct.unpack_from(HEADER, raw)
+    if magic != MAGIC or version != VERSION:
+        sys.exit('%s: not a version %d trace' % (path, VERSION))
+    records = []
+    pos = struct.calcsize(HEADER)
+    base = 0
+    last = None
+    while pos + struct.calcsize(RECORD) <= len(raw):
+        rtype, arg, length, t = struct.unpack_from(RECORD, raw, pos)
+        pos += struct.calcsize(RECORD)
+        if last is not None and t < last:
+            base += 1 << 32
+        last = t
+        records.append((rtype, arg, base + t, raw[pos:pos + length]))
+        pos += length
+    return {'n_bands': n_bands, 'block_bytes': block_bytes, 'rate': rate, 'overwritten': overwritten}, records
+
+
+def percentiles(v):
+    if len(v) == 0:
+        return 'n/a'
+    v = np.asarray(v)
+    return 'avg %.0f, p50 %.0f, p99 %.0f, max %.0f' % (v.mean(), np.percentile(v, 50), np.percentile(v, 99), v.max())
+
+
+def report(info, records):
+    span = (records[-1][2] - records[0][2]) / 1e6 if records else 0.0
+    print('%d records over %.1f s, %d overwritten before the flush, %d Hz' %
+          (len(records), span, info['overwritten'], info['rate']))
+
+    audio_t = [t for rtype, _, t, _ in records if rtype == TRC_AUDIO]
+    room = [struct.unpack_from('<HHH', p)[2] for rtype, _, _, p in records if rtype == TRC_AUDIO]
+    print('audio blocks: %d, interval us: %s' % (len(audio_t), percentiles(np.diff(audio_t))))
+    if room:
+        print('ring room at ingress: min %d bytes' % min(room))
+
+    cmd = b''.join(p for rtype, _, _, p in records if rtype == TRC_CMD)
+    print('command bytes: %d %s' % (len(cmd), cmd[:32].hex()))
+
+    waits = defaultdict(list)
+    runs = defaultdict(list)
+    for rtype, _, _, p in records:
+        if rtype == TRC_DISPATCH:
+            event, cb, wait, run = struct.unpack_from('<HIII', p)
+            waits[cb].append(wait)
+            runs[cb].append(run)
+    for cb in sorted(runs, key=lambda c: -max(runs[c])):
+        print('dispatch 0x%08x x%d: wait %s | run %s' % (cb, len(runs[cb]), percentiles(waits[cb]), percentiles(runs[cb])))
+
+    late = [struct.unpack_from('<iB', p)[0] for rtype, _, _, p in records if rtype == TRC_SHOW]
+    capped = sum(1 for rtype, arg, _, _ in records if rtype == TRC_SHOW and arg == 0)
+    print('light frames shown: %d (%d capped), late us: %s' % (len(late), capped, percentiles(late)))
+
+
+def bit_reverse(n):
+    bits = n.bit_length() - 1
+    return np.array([int(format(i, '0%db' % bits)[::-1], 2) for i in range(n)])
+
+
+class Analyzer:
+    # process_colors: esp-dsp's radix-2 FFT without dsps_bit_rev_fc32, so the
+    # bins come out in bit-reversed order, magnitude as |re| + |im|.
+    def __init__(self, n_bands):
+        self.n = n_bands
+        self.rev = bit_reverse(CHUNK_SIZE)
+        self.CD = np.zeros(n_bands, dtype=np.float32)
+        self.CS = np.zeros(n_bands, dtype=np.float32)
+        self.rate = np.zeros(n_bands, dtype=np.float32)
+        self.MAX = np.zeros(n_bands, dtype=np.float32)
+        self.MIN = np.zeros(n_bands, dtype=np.float32)
+        self.MIN[0] = np.finfo(np.float32).max
+        self.weights = []
+        for i in range(n_bands):
+            w = np.zeros(HALF_CS, dtype=np.float32)
+            for j in range(SPI[i] + 1, SPI[i + 1]):
+                w[j] += (SPI[i + 1] - j) / (SPI[i + 1] - SPI[i])
+            for j in range(SPI[i + 1], SPI[i + 2]):
+                w[j] += (SPI[i + 2] - j) / (SPI[i + 2] - SPI[i + 1])
+            self.weights.append(w)
+
+    def fft_bands(self, pcm):
+        s = np.frombuffer(pcm, dtype='<i2').reshape(-1, 2).astype(np.float32)
+        mono = (s[:CHUNK_SIZE, 0] + s[:CHUNK_SIZE, 1]) / np.float32(2.0)
+        out = np.fft.fft(mono)[self.rev][:HALF_CS]
+        spectrum = (np.abs(out.real) + np.abs(out.imag)).astype(np.float32)
+        self.CD = np.array([max(0.0, float(spectrum @ w)) for w in self.weights], dtype=np.float32)
+
+    def track_bands(self, bands):
+        self.CD = (np.exp2(np.frombuffer(bands, dtype=np.uint8).astype(np.float32) / TRACK_SCALE) - 1.0).astype(np.float32)
+
+    def silence(self):
+        self.CD = np.zeros(self.n, dtype=np.float32)
+
+    def frame(self, lift):
+        r = (self.CD - self.CS) * SMOOTHNESS
+        self.rate = np.where(np.abs(r) > self.rate, r, self.rate).astype(np.float32)
+        self.CS = (self.CS + self.rate).astype(np.float32)
+        self.MAX = np.where(self.CS >= self.MAX, self.CS, self.MAX - DROP_RATE * (self.MAX - self.CS)).astype(np.float32)
+        self.MIN = np.where(self.CS <= self.MIN, self.CS, self.MIN + RISE_RATE * (self.CS - self.MIN)).astype(np.float32)
+        span = self.MAX - self.MIN
+        V = np.where(span == 0, 0.0, (self.CS - self.MIN) / np.where(span == 0, 1.0, span)).astype(np.float32)
+        # the beat flash comes from the device's tempo tracker and is recorded with the frame
+        V = (V + lift * (np.float32(1.0) - V)).astype(np.float32)
+        return (35 + int(np.floor(V[:HNL].sum() / HNL * 220)), 35 + int(np.floor(V[HNL:].sum() / HNR * 220)))
+
+
+def replay(info, records):
+    blocks = {}
+    analyzer = Analyzer(info['n_bands'])
+    recorded, replayed = [], []
+    missing = followed = 0
+    start = time.perf_counter()
+    for rtype, arg, _, p in records:
+        if rtype == TRC_AUDIO:
+            seq = struct.unpack_from('<H', p)[0]
+            blocks[seq] = (arg, p[6:])
+        elif rtype == TRC_LIGHT:
+            seq = struct.unpack_from('<H', p)[0]
+            block = blocks.get(seq)
+            if arg == TRC_BANDS_SYNC:
+                # a sync leader's bands, not in this box's trace
+                followed += 1
+                continue
+            elif arg == TRC_BANDS_SILENCE:
+                analyzer.silence()
+            elif arg == TRC_BANDS_HELD:
+                pass
+            elif block is None or len(block[1]) == 0:
+                missing += 1
+                continue
+            elif block[0] == TRC_SRC_TRACK:
+                analyzer.track_bands(block[1])
+            else:
+                analyzer.fft_bands(block[1])
+            replayed.append(analyzer.frame(np.float32(struct.unpack_from('<f', p, 2)[0])))
+            recorded.append(tuple(p[-2:]))
+    elapsed = time.perf_counter() - start
+    audio_s = len(blocks) * info['block_bytes'] / 4.0 / info['rate']
+    if missing:
+        print('%d light frames without PCM in the trace were skipped' % missing)
+    if followed:
+        print('%d light frames from a sync leader were skipped' % followed)
+    if not replayed:
+        return np.zeros((0, 2), dtype=np.int32)
+    print('replayed %d frames in %.3f s (%.0fx real time)' % (len(replayed), elapsed, audio_s / max(elapsed, 1e-9)))
+    recorded = np.array(recorded, dtype=np.int32)
+    replayed = np.array(replayed, dtype=np.int32)
+    # replay starts from a fresh analyzer; only a trace taken from wake-up
+    # shares its state from the first frame on
+    off = np.abs(recorded - replayed).max(axis=1) > 1
+    print('neon mismatch vs device: %d of %d frames' % (off.sum(), len(off)))
+    return replayed
+
+
+def main(argv):
+    info, records = read_trace(argv[1])
+    report(info, records)
+    out = replay(info, records)
+    if '--save' in argv:
+        np.save(argv[argv.index('--save') + 1], out)
+    if '--expect' in argv:
+        ref = np.load(argv[argv.index('--expect') + 1])
+        if ref.shape != out.shape or (ref != out).any():
+            print('REGRESSION: replay differs from %s' % argv[argv.index('--expect') + 1])
+            return 1
+        print('replay matches %s' % argv[argv.index('--expect') + 1])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))